@@ -0,0 +1,177 @@
+// 线程池压测: 对比原来的"全局队列+两把锁"线程池和工作窃取线程池
+//
+// 用法: pool_bench [任务数=200000] [每个任务的计算量=200]
+//
+// 两种负载, 线程数从1到64各跑一遍:
+//   inject  外部线程连续submit, 全部经过注入队列
+//   spawn   外部只提交少量根任务, 每个任务在worker里再submit两个子任务(二叉树展开),
+//           考察worker内部提交走本地队列的效果
+// 两边都走submit(std::function<void()>), 不带future
+
+#include "../global/include/threadpool.hpp"
+#include "../global/include/safe_queue.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+    // 改成工作窃取之前的线程池, 原样保留作对照
+    class legacy_pool {
+    private:
+        class thread_worker {
+        private:
+            legacy_pool* pool_ptr;
+        public:
+            explicit thread_worker(legacy_pool* pool) : pool_ptr(pool) {}
+
+            void operator()() {
+                while (pool_ptr->pool_status <= 1) {
+                    std::function<void()> func;
+                    {
+                        std::unique_lock<std::mutex> lock(pool_ptr->m_Mutex);
+                        pool_ptr->m_Condition.wait(lock, [&]{
+                            return pool_ptr->pool_status == 1 || !pool_ptr->m_TaskQueue.empty();
+                        });
+                        if (pool_ptr->pool_status == 1 && pool_ptr->m_TaskQueue.empty())
+                            return;
+                        if (!pool_ptr->m_TaskQueue.pop(func))
+                            continue;
+                    }
+                    func();
+                }
+            }
+        };
+        safe_queue<std::function<void()>> m_TaskQueue;
+        std::vector<std::thread> m_Workers;
+    public:
+        std::mutex m_Mutex;
+        std::condition_variable m_Condition;
+        int pool_core_size;
+        int pool_status = 0;
+
+        explicit legacy_pool(int core_size) : pool_core_size(core_size) {}
+
+        void init() {
+            pool_status = 0;
+            for (int i = 0; i < pool_core_size; ++i) {
+                m_Workers.push_back(std::thread(thread_worker(this)));
+            }
+        }
+
+        void shutdown() {
+            pool_status = 1;
+            m_Condition.notify_all();
+            for (auto& worker : m_Workers) {
+                if (worker.joinable()) {
+                    worker.join();
+                }
+            }
+            m_Workers.clear();
+        }
+
+        void submit(std::function<void()> func) {
+            if (pool_status != 0) {
+                return;
+            }
+            m_TaskQueue.push(std::move(func));
+            m_Condition.notify_one();
+        }
+    };
+
+    std::atomic<uint64_t> sink{0};
+
+    void burn(int work) {
+        uint64_t x = 88172645463325252ull;
+        for (int i = 0; i < work; ++i) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+        }
+        sink.fetch_add(x & 1, std::memory_order_relaxed);
+    }
+
+    void wait_done(std::atomic<long>& done, long total) {
+        while (done.load(std::memory_order_acquire) < total) {
+            std::this_thread::yield();
+        }
+    }
+
+    template<typename Pool>
+    double run_inject(int threads, long tasks, int work) {
+        Pool pool(threads);
+        pool.init();
+        std::atomic<long> done{0};
+        auto begin = std::chrono::steady_clock::now();
+        for (long i = 0; i < tasks; ++i) {
+            pool.submit(std::function<void()>([&done, work] {
+                burn(work);
+                done.fetch_add(1, std::memory_order_release);
+            }));
+        }
+        wait_done(done, tasks);
+        auto end = std::chrono::steady_clock::now();
+        pool.shutdown();
+        return std::chrono::duration<double>(end - begin).count();
+    }
+
+    template<typename Pool>
+    struct spawner {
+        Pool* pool;
+        std::atomic<long>* done;
+        int work;
+
+        void operator()(int depth) const {
+            burn(work);
+            done->fetch_add(1, std::memory_order_release);
+            if (depth > 0) {
+                spawner self = *this;
+                pool->submit(std::function<void()>([self, depth] { self(depth - 1); }));
+                pool->submit(std::function<void()>([self, depth] { self(depth - 1); }));
+            }
+        }
+    };
+
+    template<typename Pool>
+    double run_spawn(int threads, long tasks, int work) {
+        // 64棵满二叉树, 深度取到总节点数不少于tasks
+        const int roots = 64;
+        int depth = 0;
+        while (static_cast<long>(roots) * ((2L << depth) - 1) < tasks) {
+            ++depth;
+        }
+        long total = static_cast<long>(roots) * ((2L << depth) - 1);
+        Pool pool(threads);
+        pool.init();
+        std::atomic<long> done{0};
+        spawner<Pool> sp{&pool, &done, work};
+        auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < roots; ++i) {
+            pool.submit(std::function<void()>([sp, depth] { sp(depth); }));
+        }
+        wait_done(done, total);
+        auto end = std::chrono::steady_clock::now();
+        pool.shutdown();
+        return std::chrono::duration<double>(end - begin).count() * tasks / total;
+    }
+
+    void print(const char* load, int threads, long tasks, double legacy, double ws) {
+        printf("%-7s threads=%-3d legacy=%8.0f task/s  stealing=%8.0f task/s  x%.2f\n",
+               load, threads, tasks / legacy, tasks / ws, legacy / ws);
+    }
+}
+
+int main(int argc, char** argv) {
+    long tasks = argc > 1 ? atol(argv[1]) : 200000;
+    int work = argc > 2 ? atoi(argv[2]) : 200;
+    for (int threads = 1; threads <= 64; threads *= 2) {
+        print("inject", threads, tasks,
+              run_inject<legacy_pool>(threads, tasks, work),
+              run_inject<thread_pool>(threads, tasks, work));
+    }
+    for (int threads = 1; threads <= 64; threads *= 2) {
+        print("spawn", threads, tasks,
+              run_spawn<legacy_pool>(threads, tasks, work),
+              run_spawn<thread_pool>(threads, tasks, work));
+    }
+    return 0;
+}
@@ -0,0 +1,117 @@
+// reactor压测: 对比"摘除+重新添加"和"一次性布防+MOD重布防"两种用法
+// 每条消息的epoll_ctl次数
+//
+// 用法: reactor_bench [连接数=64] [每连接消息数=2000]
+//
+// 每个连接是一对socketpair, 写线程轮流往各连接写一条64字节的消息,
+// reactor线程读到就绪后按对应模式处理: 读到EAGAIN, 再恢复关注
+
+#include "../io/include/reactor.hpp"
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+namespace {
+    constexpr size_t MSG_SIZE = 64;
+
+    struct result {
+        uint64_t messages = 0;
+        reactor_stats st;
+        double seconds = 0;
+    };
+
+    result run(bool oneshot, int conns, int msgs_per_conn) {
+        reactor re(1024, 100);
+        std::vector<int> rfds, wfds;
+        std::vector<event*> evs;
+        for (int i = 0; i < conns; ++i) {
+            int sv[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+                perror("socketpair");
+                exit(1);
+            }
+            fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+            rfds.push_back(sv[0]);
+            wfds.push_back(sv[1]);
+            uint32_t mode = EPOLLIN | EPOLLET | (oneshot ? EPOLLONESHOT : 0);
+            event* ev = new event(sv[0], mode);
+            ev->bind_with(&re);
+            re.add_revent(ev, sv[0]);
+            ev->add_to_reactor();
+            evs.push_back(ev);
+        }
+        re.run_pending(); // 本线程就是reactor线程, 执行初始布防
+        re.reset_stats();
+
+        uint64_t total = static_cast<uint64_t>(conns) * msgs_per_conn;
+        auto begin = std::chrono::steady_clock::now();
+        std::thread writer([&]() {
+            char msg[MSG_SIZE] = {0};
+            for (int m = 0; m < msgs_per_conn; ++m) {
+                for (int i = 0; i < conns; ++i) {
+                    if (write(wfds[i], msg, MSG_SIZE) != (ssize_t)MSG_SIZE) {
+                        perror("write");
+                        exit(1);
+                    }
+                }
+            }
+        });
+
+        uint64_t received = 0; // 字节数
+        char buf[16 * 1024];
+        while (received < total * MSG_SIZE) {
+            int n = re.wait();
+            for (int i = 0; i < n; ++i) {
+                auto slot = static_cast<event_slot*>(re.epoll_events[i].data.ptr);
+                int fd = slot->fd;
+                event* ev = slot->read;
+                if (oneshot) {
+                    if (!(ev->on_fire(re.epoll_events[i].events) & EPOLLIN)) continue;
+                } else {
+                    ev->remove_from_reactor();
+                }
+                ssize_t r;
+                while ((r = read(fd, buf, sizeof(buf))) > 0) {
+                    received += static_cast<uint64_t>(r);
+                }
+                ev->add_to_reactor();
+            }
+            re.run_pending();
+        }
+        writer.join();
+        auto end = std::chrono::steady_clock::now();
+
+        result res;
+        res.messages = total;
+        res.st = re.stats();
+        res.seconds = std::chrono::duration<double>(end - begin).count();
+        for (auto ev : evs) delete ev;
+        for (int fd : rfds) close(fd);
+        for (int fd : wfds) close(fd);
+        return res;
+    }
+
+    void print(const char* name, const result& r) {
+        printf("%-16s msgs=%-9llu wait=%-8llu ready=%-8llu ctl=%-8llu ctl/msg=%.3f ctl/ready=%.2f  %.3fs\n",
+               name,
+               (unsigned long long)r.messages,
+               (unsigned long long)r.st.wait_calls,
+               (unsigned long long)r.st.ready_events,
+               (unsigned long long)r.st.ctl_calls,
+               (double)r.st.ctl_calls / r.messages,
+               r.st.ready_events ? (double)r.st.ctl_calls / r.st.ready_events : 0.0,
+               r.seconds);
+    }
+}
+
+int main(int argc, char** argv) {
+    int conns = argc > 1 ? atoi(argv[1]) : 64;
+    int msgs = argc > 2 ? atoi(argv[2]) : 2000;
+    print("remove+add", run(false, conns, msgs));
+    print("oneshot+rearm", run(true, conns, msgs));
+    return 0;
+}
@@ -0,0 +1,160 @@
+// 接收路径解析压测: 对比每帧新建消息对象和按线程复用/只读视图两种解析方式
+//
+// 用法: recv_bench [每种帧的次数=200000]
+// 要看分配次数需配置时加 -DCOUNT_ALLOCS=ON, 否则只有耗时
+//
+// 几种帧都按服务器收到的样子构造(v1/v2), 每种分别跑:
+//   fresh   每帧新建scratch和ChatMessage/CommandRequest/FileChunk, 命令参数整个拷一份(原来的做法, 解帧同样用现在的wire::decode)
+//   reused  scratch和命令/分片消息按线程复用, 聊天消息只解析出chat_view(现在dispatch_recv的做法)
+
+#include "../global/abstract/datatypes.hpp"
+#include "../global/include/alloc_counter.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <vector>
+
+namespace {
+    struct result {
+        double ns_per_frame;
+        double allocs_per_frame;
+    };
+
+    // 先热身一轮, 让复用的对象把容量撑到位, 再计时计数
+    result run(long rounds, const std::function<bool()>& once) {
+        for (int i = 0; i < 16; ++i) {
+            once();
+        }
+        alloc_counter::scope allocs;
+        auto begin = std::chrono::steady_clock::now();
+        long ok = 0;
+        for (long i = 0; i < rounds; ++i) {
+            ok += once();
+        }
+        auto end = std::chrono::steady_clock::now();
+        if (ok != rounds) {
+            printf("parse failed\n");
+            exit(1);
+        }
+        return {
+            std::chrono::duration<double, std::nano>(end - begin).count() / rounds,
+            static_cast<double>(allocs.since()) / rounds
+        };
+    }
+
+    void print(const char* name, result fresh, result reused) {
+        if (alloc_counter::enabled) {
+            printf("%-12s fresh=%7.1f ns %6.2f allocs  reused=%7.1f ns %6.2f allocs\n",
+                   name, fresh.ns_per_frame, fresh.allocs_per_frame, reused.ns_per_frame, reused.allocs_per_frame);
+        } else {
+            printf("%-12s fresh=%7.1f ns  reused=%7.1f ns\n", name, fresh.ns_per_frame, reused.ns_per_frame);
+        }
+    }
+
+    void bench_message(const char* name, const std::string& frame, long rounds) {
+        result fresh = run(rounds, [&] {
+            wire::scratch sc;
+            std::string_view body;
+            if (wire::decode(frame, body, sc) != DataType::Message) {
+                return false;
+            }
+            ChatMessage msg;
+            return msg.ParseFromArray(body.data(), static_cast<int>(body.size()));
+        });
+        wire::scratch sc;
+        result reused = run(rounds, [&] {
+            std::string_view body;
+            if (wire::decode(frame, body, sc) != DataType::Message) {
+                return false;
+            }
+            wire::chat_view msg;
+            return msg.parse(body);
+        });
+        print(name, fresh, reused);
+    }
+
+    void bench_command(const char* name, const std::string& frame, long rounds) {
+        result fresh = run(rounds, [&] {
+            wire::scratch sc;
+            std::string_view body;
+            if (wire::decode(frame, body, sc) != DataType::Command) {
+                return false;
+            }
+            CommandRequest cmd;
+            if (!cmd.ParseFromArray(body.data(), static_cast<int>(body.size()))) {
+                return false;
+            }
+            std::string subj = cmd.sender();
+            auto args = cmd.args();
+            return !subj.empty() && args.size() > 0;
+        });
+        wire::scratch sc;
+        result reused = run(rounds, [&] {
+            std::string_view body;
+            if (wire::decode(frame, body, sc) != DataType::Command) {
+                return false;
+            }
+            if (!sc.cmd.ParseFromArray(body.data(), static_cast<int>(body.size()))) {
+                return false;
+            }
+            const std::string& subj = sc.cmd.sender();
+            const auto& args = sc.cmd.args();
+            return !subj.empty() && args.size() > 0;
+        });
+        print(name, fresh, reused);
+    }
+
+    void bench_file_chunk(const char* name, const std::string& frame, long rounds) {
+        result fresh = run(rounds, [&] {
+            wire::scratch sc;
+            std::string_view body;
+            if (wire::decode(frame, body, sc) != DataType::FileChunk) {
+                return false;
+            }
+            FileChunk chunk;
+            if (!chunk.ParseFromArray(body.data(), static_cast<int>(body.size()))) {
+                return false;
+            }
+            std::vector<char> data(chunk.data().begin(), chunk.data().end());
+            return !data.empty();
+        });
+        wire::scratch sc;
+        result reused = run(rounds, [&] {
+            std::string_view body;
+            if (wire::decode(frame, body, sc) != DataType::FileChunk) {
+                return false;
+            }
+            if (!sc.chunk.ParseFromArray(body.data(), static_cast<int>(body.size()))) {
+                return false;
+            }
+            return !sc.chunk.data().empty();
+        });
+        print(name, fresh, reused);
+    }
+}
+
+int main(int argc, char** argv) {
+    long rounds = argc > 1 ? atol(argv[1]) : 200000;
+    if (!alloc_counter::enabled) {
+        printf("allocation counting is off, configure with -DCOUNT_ALLOCS=ON to see it\n");
+    }
+
+    std::string text(300, 'x');
+    std::vector<char> data(32 * 1024, 'd');
+    for (int version = 1; version <= 2; ++version) {
+        wire::set_version(version);
+        std::string message = create_message_string("sender_0001", "receiver_0002", false, 1700000000000000, text);
+        std::string group = create_message_string("sender_0001", "group_0042", true, 1700000000000000, text);
+        std::string command = create_command_string(Action::Add_Friend_Req, "sender_0001",
+            {"receiver_0002", "please accept my friend request, we met yesterday"});
+        std::string chunk = create_file_chunk_string("File_12345", data, 3, 10, false);
+
+        printf("-- v%d frames\n", version);
+        bench_message("message", message, rounds);
+        bench_message("group", group, rounds);
+        bench_command("command", command, rounds);
+        bench_file_chunk("file_chunk", chunk, rounds / 10);
+    }
+    return 0;
+}
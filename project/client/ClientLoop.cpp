@@ -0,0 +1,225 @@
+#include "include/ClientLoop.hpp"
+#include "../global/include/logging.hpp"
+#include "../global/abstract/datatypes.hpp"
+
+ClientLoop::ClientLoop(TcpClient* const clients[3], bool mux) : re(64, 1000), mux(mux) {
+    for (int i = 0; i < mux::CHANNEL_NUM; ++i) {
+        if (mux && i != 1) {
+            continue; // 复用模式三个通道都走命令连接
+        }
+        links[i] = std::make_unique<link>();
+        links[i]->client = clients[i];
+    }
+}
+
+ClientLoop::~ClientLoop() {
+    stop();
+    release_events();
+}
+
+void ClientLoop::release_events() {
+    for (auto& l : links) {
+        if (l) {
+            delete l->read_event;
+            delete l->write_event;
+            l->read_event = nullptr;
+            l->write_event = nullptr;
+        }
+    }
+}
+
+ClientLoop::link* ClientLoop::link_of(int channel) {
+    return mux ? links[1].get() : links[channel].get();
+}
+
+bool ClientLoop::open() {
+    for (int i = 0; i < mux::CHANNEL_NUM; ++i) {
+        auto& l = links[i];
+        if (!l) {
+            continue;
+        }
+        int fd = l->client->socket->get_fd();
+        l->client->socket->set_nonblocking();
+        l->read_event = new event(fd, EPOLLIN | EPOLLET | EPOLLONESHOT);
+        l->write_event = new event(fd, EPOLLOUT | EPOLLET | EPOLLONESHOT);
+        l->read_event->bind_with(&re);
+        l->write_event->bind_with(&re);
+        l->read_event->set([this, i] { on_readable(i); });
+        l->write_event->set([this, raw = l.get()] { flush(raw); });
+        re.add_revent(l->read_event, fd);
+        re.add_wevent(l->write_event, fd);
+        l->read_event->add_to_reactor(); // 事件线程还没起来, 先排进任务队列
+    }
+    if (mux) {
+        // 这一帧还是普通格式, 服务器处理完之后才按复用格式解析
+        auto hello = create_command_string(Action::Mux_Connection, "", {});
+        links[1]->out.push(std::move(hello));
+        flush(links[1].get());
+    }
+    return true;
+}
+
+void ClientLoop::start() {
+    running = true;
+    loop_thread = std::thread(&ClientLoop::loop, this);
+}
+
+void ClientLoop::stop() {
+    if (!running.exchange(false)) {
+        return;
+    }
+    re.wakeup();
+    if (loop_thread.joinable()) {
+        loop_thread.join();
+    }
+    for (auto& l : links) {
+        if (l) {
+            l->out.close();
+        }
+    }
+    release_events(); // 趁socket还没关, 把fd从epoll里摘掉
+    for (auto& q : inbox) {
+        q.push(""); // 放行阻塞在read()上的调用方
+    }
+}
+
+void ClientLoop::loop() {
+    while (running) {
+        int num_ready = re.wait();
+        if (num_ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_error("Client epoll wait failed: {}", strerror(errno));
+            break;
+        }
+        for (int i = 0; i < num_ready; ++i) {
+            auto ev = re.epoll_events[i];
+            auto slot = static_cast<event_slot*>(ev.data.ptr);
+            if (slot->read == nullptr) {
+                continue;
+            }
+            uint32_t fired = slot->read->on_fire(ev.events);
+            if (fired & EPOLLIN) {
+                slot->read->call_back();
+            }
+            if ((fired & EPOLLOUT) && slot->write) {
+                slot->write->call_back();
+            }
+        }
+        re.run_pending();
+    }
+}
+
+void ClientLoop::on_readable(int channel) {
+    link* l = links[channel].get();
+    std::string_view frame;
+    while (true) {
+        auto state = l->client->socket->receive_frame(frame);
+        if (state == DataSocket::RecvState::NoMoreData) {
+            break;
+        }
+        if (state != DataSocket::RecvState::Success) {
+            log_info("Connection {} closed by server", channel);
+            close_link(l);
+            return;
+        }
+        if (!mux) {
+            deliver(channel, frame);
+            continue;
+        }
+        int ch;
+        std::string_view packet;
+        if (mux_in.feed(frame, ch, packet)) {
+            deliver(ch, packet);
+        } else if (ch < 0) {
+            log_error("Invalid mux frame of size {}", frame.size());
+        }
+    }
+    l->read_event->add_to_reactor();
+}
+
+void ClientLoop::deliver(int channel, std::string_view packet) {
+    if (handlers[channel]) {
+        handlers[channel](std::string(packet));
+    } else {
+        inbox[channel].push(std::string(packet));
+    }
+}
+
+void ClientLoop::on_frame(int channel, frame_cb cb) {
+    handlers[channel] = std::move(cb);
+}
+
+bool ClientLoop::send(int channel, const std::string& proto) {
+    link* l = link_of(channel);
+    if (!l || l->closed) {
+        return false;
+    }
+    // 背压: 积压太多先等事件线程写下去
+    if (l->out.above_high() && !l->out.wait_below_low(std::chrono::seconds(30))) {
+        log_error("Connection {} is not draining, drop frame", channel);
+        return false;
+    }
+    outbound_queue::PushResult res = outbound_queue::PushResult::Queued;
+    if (mux) {
+        // 分片整体入队, 几个线程同时在一个通道上发也不会把包拼错
+        outbound_queue::batch pieces;
+        for (auto& piece : mux::split(channel, proto)) {
+            pieces.add(std::move(piece));
+        }
+        res = l->out.push_many(std::move(pieces), channel);
+    } else {
+        res = l->out.push(proto);
+    }
+    if (res == outbound_queue::PushResult::Overflow || res == outbound_queue::PushResult::Closed) {
+        log_error("Failed to queue frame on connection {}", channel);
+        return false;
+    }
+    flush(l);
+    return true;
+}
+
+void ClientLoop::flush(link* l) {
+    switch (l->out.flush(l->client->socket->get_fd())) {
+        case outbound_queue::FlushResult::Blocked:
+            // 内核缓冲区满, 等EPOLLOUT由事件线程续写
+            if (running) {
+                l->write_event->add_to_reactor();
+            }
+            break;
+        case outbound_queue::FlushResult::Error:
+            log_error("Failed to send to server: {}", strerror(errno));
+            close_link(l);
+            break;
+        default:
+            break;
+    }
+}
+
+void ClientLoop::close_link(link* l) {
+    if (l->closed.exchange(true)) {
+        return;
+    }
+    l->out.close();
+    // 业务线程可能在等数据通道的回应, 放行
+    for (auto& q : inbox) {
+        q.push("");
+    }
+}
+
+bool ClientLoop::read(int channel, std::string& proto) {
+    link* l = link_of(channel);
+    if ((!l || l->closed) && inbox[channel].empty()) {
+        return false;
+    }
+    inbox[channel].wait_and_pop(proto);
+    return !proto.empty();
+}
+
+bool ClientLoop::read_for(int channel, std::string& proto, std::chrono::milliseconds timeout) {
+    if (!inbox[channel].wait_for_and_pop(proto, timeout)) {
+        return false;
+    }
+    return !proto.empty();
+}
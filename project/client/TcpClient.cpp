@@ -2,6 +2,7 @@
 
 namespace set_addr_c {
     Addr client_addr[3];
+    bool mux = false;
 }
 
 TcpClient::TcpClient(std::string server_ip, uint16_t server_port) {
@@ -1,5 +1,6 @@
 #include "include/TopClient.hpp"
 #include "include/TcpClient.hpp"
+#include "include/ClientLoop.hpp"
 #include "../global/include/threadpool.hpp"
 #include "include/CommManager.hpp"
 #include "include/winloop.hpp"
@@ -14,6 +15,8 @@ TopClient::TopClient() {
     data_client = new TcpClient(
         set_addr_c::client_addr[2].first,
         set_addr_c::client_addr[2].second);
+    TcpClient* const clients[3] = {message_client, command_client, data_client};
+    io_loop = new ClientLoop(clients, set_addr_c::mux);
     pool = new thread_pool(8);
     comm = new CommManager(this);
     winloop = new WinLoop(comm, pool);
@@ -21,6 +24,7 @@ TopClient::TopClient() {
 }
 
 TopClient::~TopClient() {
+    delete io_loop;
     delete message_client;
     delete command_client;
     delete data_client;
@@ -30,24 +34,35 @@ TopClient::~TopClient() {
 
 void TopClient::launch() {
     running = true;
-    // 启动三个客户端
-    message_client->start();
-    command_client->start();
-    data_client->start();
+    // 启动三个客户端, 复用模式只连命令服务器
+    if (set_addr_c::mux) {
+        command_client->start();
+    } else {
+        message_client->start();
+        command_client->start();
+        data_client->start();
+    }
+    io_loop->open();
     // 初始化线程池
     pool->init();
-    // 启动命令行界面
+    // 启动命令行界面, 先设好收包回调再起事件线程
     winloop->init();
+    io_loop->start();
     winloop->run();
     stop();
     return;
 }
 
 void TopClient::stop() {
-    // 停止三个客户端
-    message_client->stop();
-    command_client->stop();
-    data_client->stop();
+    // 先停事件线程, 再断开连接
+    io_loop->stop();
+    if (set_addr_c::mux) {
+        command_client->stop();
+    } else {
+        message_client->stop();
+        command_client->stop();
+        data_client->stop();
+    }
     // 停止线程池
     pool->shutdown();
     winloop->stop();
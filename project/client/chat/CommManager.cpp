@@ -1,6 +1,7 @@
 #include "../include//CommManager.hpp"
 #include "../include/TopClient.hpp"
 #include "../include/TcpClient.hpp"
+#include "../include/ClientLoop.hpp"
 #include "../../global/include/threadpool.hpp"
 #include "../../global/abstract/datatypes.hpp"
 #include "../../global/include/logging.hpp"
@@ -28,24 +29,23 @@ CommManager::CommManager(TopClient* client)
 
 std::string CommManager::read(int idx) {
     std::string proto;
-    clients[idx]->socket->receive_protocol(proto);
+    top_client->io_loop->read(idx, proto);
     log_debug("Received data from connection {}: size={}", idx, proto.size());
     return proto;
 }
 
 auto CommManager::read_async(int idx) {
     return top_client->pool->submit([this, idx](){
-        std::string proto;
-        clients[idx]->socket->receive_protocol(proto);
-        return proto;
+        return read(idx);
     });
 }
 
 void CommManager::send(int idx, const std::string& proto) {
     log_debug("Sending data to connection {} of size {}", idx, proto.size());
-    bool success = clients[idx]->socket->send_protocol(proto);
+    // 入队即返回, 由事件线程负责写完
+    bool success = top_client->io_loop->send(idx, proto);
     if (success) {
-        log_debug("Successfully sent data to connection {}", idx);
+        log_debug("Successfully queued data to connection {}", idx);
     } else {
         log_error("Failed to send data to connection {}", idx);
     }
@@ -53,49 +53,24 @@ void CommManager::send(int idx, const std::string& proto) {
 
 auto CommManager::send_async(int idx, const std::string& proto) {
     return top_client->pool->submit([this, idx, proto](){
-        return clients[idx]->socket->send_protocol(proto);
+        return top_client->io_loop->send(idx, proto);
     });
 }
 
 std::string CommManager::read_nb(int idx) {
     std::string proto;
-    DataSocket::RecvState state;
-    auto start = std::chrono::steady_clock::now();
     const int timeout_ms = 500; // 超时时间，可根据需要调整
-    while (win->running) {
-        state = clients[idx]->socket->receive_protocol_with_state(proto);
-        switch (state) {
-            case DataSocket::RecvState::Success:
-                return proto;
-            case DataSocket::RecvState::NoMoreData: {
-                auto now = std::chrono::steady_clock::now();
-                auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - start).count();
-                if (elapsed > timeout_ms) {
-                    log_debug("read_nb timeout ({} ms) for connection {}", elapsed, idx);
-                    return "";
-                }
-                continue;
-            }
-            case DataSocket::RecvState::Disconnected: {
-                log_info("Connection {} disconnected", idx);
-                return "";
-            }
-            default: {
-                log_error("Error receiving data from connection {}: {}", idx, proto);
-                return "";
-            }
-        }
+    // 由事件线程收包, 这里只等这个通道的队列, 不再空转
+    if (!top_client->io_loop->read_for(idx, proto, std::chrono::milliseconds(timeout_ms))) {
+        log_debug("read_nb timeout ({} ms) for connection {}", timeout_ms, idx);
+        return "";
     }
-    return "";
+    return proto;
 }
 
 void CommManager::send_nb(int idx, const std::string& proto) {
-    while (win->running) {
-        if (clients[idx]->socket->send_protocol(proto)) {
-            return;
-        }
-    }
-    return;
+    // 发送本来就不阻塞了, 和send()一样
+    top_client->io_loop->send(idx, proto);
 }
 
 /* ---------- Handlers ---------- */
@@ -261,7 +236,9 @@ void CommManager::handle_send_file_chunk(
 // others
 
 void CommManager::handle_send_id() {
-    for (int i=0; i<3; ++i) {
+    // 复用连接服务器端一次登记三个位置
+    int conn_num = set_addr_c::mux ? 1 : 3;
+    for (int i=0; i<conn_num; ++i) {
         auto env_out = create_command_string(
             Action::Remember_Connection, cache.user_ID, {std::to_string(i)});
         this->send(i, env_out);
@@ -3,7 +3,11 @@
 #include "../../global/include/logging.hpp"
 #include "../../global/abstract/datatypes.hpp"
 #include "../../global/include/threadpool.hpp"
+#include "../../global/include/strand.hpp"
 #include "../include/TcpClient.hpp"
+#include "../include/TopClient.hpp"
+#include "../include/ClientLoop.hpp"
+#include "../../global/abstract/wire_codec.hpp"
 #include "../include/sqlite.hpp"
 #include <iostream>
 #include <regex>
@@ -90,57 +94,57 @@ namespace {
 }
 
 WinLoop::WinLoop(CommManager* comm, thread_pool* pool)
-    : current_page(UIPage::Start), comm(comm), pool(pool) {}
+    : current_page(UIPage::Start), comm(comm), pool(pool),
+      msg_strand(std::make_unique<strand>(pool)),
+      cmd_strand(std::make_unique<strand>(pool)) {}
 
 void WinLoop::init() {
     running = true;
     // 生成临时ID
     auto id = "_" + std::to_string(now_us()) + "_";
-    auto ip = comm->clients[0]->socket->get_local_ip();
+    bool mux = set_addr_c::mux;
+    auto ip = comm->clients[mux ? 1 : 0]->socket->get_local_ip();
     id += ip + '_';
     comm->cache.temp_user_ID = id; // 设置临时ID = _time_ip_ 太丑陋了
-    // Message, Command循环读, Data适时读, 所有通道适时写
-    pool->submit([&]{
-        comm->clients[0]->socket->set_nonblocking();
-        while (running) {
+    // Message, Command由事件线程收到即回调, Data由业务适时读, 所有通道适时写
+    // 回调在事件线程里, 解析和处理按通道投到strand上, 保证先收到的先入库、先显示
+    comm->top_client->io_loop->on_frame(0, [this](std::string proto) {
+        msg_strand->post([this, proto = std::move(proto)]() {
             try {
-                auto msg = comm->handle_receive_message();
+                auto msg = get_chat_message(proto);
                 if (!msg.timestamp()) {
-                    continue;
+                    return;
                 }
-                pool->submit([msg, this](){
-                    this->comm->handle_manage_message(msg); // 直接调用处理
-                });
+                this->comm->handle_manage_message(msg); // 直接调用处理
             } catch (const std::exception& e) {
                 log_error("Error occurred while processing message: {}", e.what());
             }
-        }
+        });
     });
-    pool->submit([&]{
-        comm->clients[1]->socket->set_nonblocking();
-        while (running) {
+    comm->top_client->io_loop->on_frame(1, [this](std::string proto) {
+        cmd_strand->post([this, proto = std::move(proto)]() {
             try {
-                auto cmd = comm->handle_receive_command();
-                if (cmd.action() == 0) { // 0 是sign in，这里表示空
-                    continue;
+                auto cmd = get_command_request(proto);
+                if (cmd.action() == 0) { // 0 是sign in，服务器不会单独推送
+                    return;
                 }
-                pool->submit([cmd, this](){
-                    log_debug("Received command: action={}, sender={}",
-                        static_cast<int>(cmd.action()), cmd.sender());
-                    this->dispatch_cmd(cmd); // 分发给不同的处理函数
-                });
+                log_debug("Received command: action={}, sender={}",
+                    static_cast<int>(cmd.action()), cmd.sender());
+                this->dispatch_cmd(cmd); // 分发给不同的处理函数
             } catch (const std::exception& e) {
                 log_error("Error occurred while processing command: {}", e.what());
             }
-        }
+        });
     });
-    for (int i=0; i<3; ++i) { // 服务器三合一认证
+    for (int i=0; i<(mux ? 1 : 3); ++i) { // 服务器三合一认证, 复用连接一次登记三个位置
         auto str = create_command_string(
             Action::Set_Temp_Connection,
             comm->cache.temp_user_ID,
             {std::to_string(i)}
         );
         comm->send_nb(i, str);
+        // 协商帧格式, 老服务器不认这个命令, 不回应就一直用v1
+        comm->send_nb(i, create_command_string(Action::Wire_Version, comm->cache.temp_user_ID, {"2", std::to_string(mux ? 1 : i), wire::available() ? wire::CODEC_NAME : ""}));
     }
 }
 
@@ -332,6 +336,17 @@ void WinLoop::dispatch_cmd(const CommandRequest& cmd) {
             comm->handle_reply_heartbeat();
             return;
         }
+        case Action::Wire_Version: {          // 服务器认v2帧格式, 之后发出的帧都用v2
+            if (cmd.args_size() > 0 && std::atoi(cmd.args(0).c_str()) >= 2) {
+                wire::set_version(2);
+                log_info("Switched to wire format v2");
+                if (cmd.args_size() > 2 && cmd.args(2) == wire::CODEC_NAME) {
+                    wire::set_compression(true);
+                    log_info("Frame compression enabled: {}", cmd.args(2));
+                }
+            }
+            return;
+        }
         default: {
             log_error("Unknown action in command: {}", static_cast<int>(action));
             return;
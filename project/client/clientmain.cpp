@@ -9,7 +9,7 @@ int main(int argc, char* argv[]) {
     std::signal(SIGINT, SIG_IGN);
     std::signal(SIGQUIT, SIG_IGN);
     std::signal(SIGTSTP, SIG_IGN);
-    if (argc == 5) {
+    if (argc >= 5) {
         std::string addr = argv[1];
         uint16_t port1 = std::stoi(argv[2]);
         uint16_t port2 = std::stoi(argv[3]);
@@ -17,6 +17,9 @@ int main(int argc, char* argv[]) {
         set_addr_c::client_addr[0] = {addr, port1};
         set_addr_c::client_addr[1] = {addr, port2};
         set_addr_c::client_addr[2] = {addr, port3};
+        if (argc > 5 && std::string(argv[5]) == "--mux") {
+            set_addr_c::mux = true;
+        }
     }
     // 创建日志目录
     std::filesystem::create_directories(std::getenv("HOME") + std::string("/.local/share/ChatRoom/log/"));
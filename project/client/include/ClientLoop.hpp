@@ -0,0 +1,70 @@
+#pragma once
+
+#include "TcpClient.hpp"
+#include "../../io/include/reactor.hpp"
+#include "../../io/include/outbound_queue.hpp"
+#include "../../io/include/mux_frame.hpp"
+#include "../../global/include/safe_queue.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+
+/*
+    客户端的事件线程: 一个reactor管所有连接(三条, 或复用模式下的一条)
+    - 读: 一次性布防的EPOLLIN, 就绪后读到EAGAIN, 按通道交给回调;
+      没设回调的通道(数据通道, 由业务同步读)放进队列, read()/read_for()去取
+    - 写: send()入队后由调用方线程直接写, 写不动才布防EPOLLOUT, 由事件线程续写;
+      队列超过高水位时send()等它降下来, 上传大文件不会把内存撑爆
+    - 回调在事件线程里执行, 不能阻塞, 重活交给线程池
+*/
+class ClientLoop {
+public:
+    using frame_cb = std::function<void(std::string)>;
+
+    ClientLoop(TcpClient* const clients[3], bool mux);
+    ~ClientLoop();
+    ClientLoop(const ClientLoop&) = delete;
+    ClientLoop& operator=(const ClientLoop&) = delete;
+
+    // 连接建立后调用: 设非阻塞并登记事件; 复用模式下先发切换请求
+    bool open();
+    // 启动事件线程, 之前设好回调
+    void start();
+    void stop();
+
+    void on_frame(int channel, frame_cb cb);
+    bool send(int channel, const std::string& proto);
+    // 阻塞读, 连接断开后返回false
+    bool read(int channel, std::string& proto);
+    bool read_for(int channel, std::string& proto, std::chrono::milliseconds timeout);
+
+private:
+    struct link {
+        TcpClient* client = nullptr;
+        event* read_event = nullptr;
+        event* write_event = nullptr;
+        outbound_queue out;
+        std::atomic<bool> closed = false;
+    };
+
+    reactor re;
+    bool mux;
+    std::array<std::unique_ptr<link>, mux::CHANNEL_NUM> links; // 复用模式下只有links[1]
+    std::array<frame_cb, mux::CHANNEL_NUM> handlers;
+    safe_queue<std::string> inbox[mux::CHANNEL_NUM];
+    mux::reassembler mux_in; // 只在事件线程里用
+    std::thread loop_thread;
+    std::atomic<bool> running = false;
+
+    link* link_of(int channel);
+    void loop();
+    void on_readable(int channel);
+    void deliver(int channel, std::string_view packet);
+    void flush(link* l);
+    void close_link(link* l);
+    void release_events();
+};
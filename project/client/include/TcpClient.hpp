@@ -9,6 +9,7 @@
 namespace set_addr_c {
     using Addr = std::pair<std::string, uint16_t>;
     extern Addr client_addr[3];
+    extern bool mux; // 三个通道复用命令服务器的一条连接
 }
 
 class TcpClient {
@@ -2,6 +2,7 @@
 
 // class TerminalInput;
 class TcpClient;
+class ClientLoop;
 class thread_pool;
 // class StartWin;
 // class MainWin;
@@ -13,6 +14,7 @@ public:
     TcpClient* message_client;
     TcpClient* command_client;
     TcpClient* data_client;
+    ClientLoop* io_loop;             // 所有连接的收发都在它的事件线程里; 复用模式下只用command_client
     thread_pool* pool;
     CommManager* comm;
     WinLoop* winloop;
@@ -16,6 +16,7 @@ class ChatMessage;
 
 class CommManager;
 class thread_pool;
+class strand;
 class CommandRequest;
 
 // 页面状态枚举
@@ -88,6 +89,9 @@ private:
 
     CommManager* comm = nullptr; // 通信管理器
     thread_pool* pool = nullptr; // 线程池
+    // 收到的消息/命令各走一个strand, 同一通道按到达顺序处理, 两个通道之间并行
+    std::unique_ptr<strand> msg_strand;
+    std::unique_ptr<strand> cmd_strand;
 
     std::mutex output_mutex;
 };
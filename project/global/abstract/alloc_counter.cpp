@@ -0,0 +1,78 @@
+#include "../include/alloc_counter.hpp"
+
+#ifdef CHATROOM_COUNT_ALLOCS
+
+#include <cstdlib>
+#include <new>
+
+namespace {
+    thread_local std::uint64_t allocations = 0;
+
+    void* counted_alloc(std::size_t size) {
+        ++allocations;
+        if (size == 0) {
+            size = 1;
+        }
+        while (true) {
+            if (void* p = std::malloc(size)) {
+                return p;
+            }
+            std::new_handler handler = std::get_new_handler();
+            if (!handler) {
+                throw std::bad_alloc();
+            }
+            handler();
+        }
+    }
+
+    void* counted_alloc_aligned(std::size_t size, std::align_val_t align) {
+        ++allocations;
+        std::size_t a = static_cast<std::size_t>(align);
+        // aligned_alloc要求size是对齐的整数倍
+        size = (size + a - 1) / a * a;
+        while (true) {
+            if (void* p = std::aligned_alloc(a, size ? size : a)) {
+                return p;
+            }
+            std::new_handler handler = std::get_new_handler();
+            if (!handler) {
+                throw std::bad_alloc();
+            }
+            handler();
+        }
+    }
+}
+
+std::uint64_t alloc_counter::thread_count() {
+    return allocations;
+}
+
+void* operator new(std::size_t size) { return counted_alloc(size); }
+void* operator new[](std::size_t size) { return counted_alloc(size); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return counted_alloc(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return counted_alloc(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+void* operator new(std::size_t size, std::align_val_t align) { return counted_alloc_aligned(size, align); }
+void* operator new[](std::size_t size, std::align_val_t align) { return counted_alloc_aligned(size, align); }
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+
+#endif
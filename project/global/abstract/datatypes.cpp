@@ -1,7 +1,237 @@
 #include "../include/time_utils.hpp"
 #include "datatypes.hpp"
+#include "wire_codec.hpp"
 #include <iostream>
 #include <ctime>
+#include <atomic>
+#include <stdexcept>
+
+/* ---------- Wire format ---------- */
+
+namespace {
+    std::atomic<int> wire_version{1};
+
+    const std::string& type_url_of(DataType type) {
+        static const std::string urls[] = {
+            "",
+            "type.googleapis.com/" + ChatMessage::descriptor()->full_name(),
+            "type.googleapis.com/" + CommandRequest::descriptor()->full_name(),
+            "type.googleapis.com/" + FileChunk::descriptor()->full_name(),
+            "type.googleapis.com/" + SyncItem::descriptor()->full_name(),
+            "type.googleapis.com/" + OfflineMessages::descriptor()->full_name(),
+        };
+        size_t idx = static_cast<size_t>(type);
+        return idx < std::size(urls) ? urls[idx] : urls[0];
+    }
+
+    DataType type_of_url(std::string_view url) {
+        for (int i = 1; i <= static_cast<int>(DataType::OfflineMessages); ++i) {
+            if (url == type_url_of(static_cast<DataType>(i))) {
+                return static_cast<DataType>(i);
+            }
+        }
+        return DataType::None;
+    }
+
+    // 按当前版本打包
+    std::string pack(DataType type, const google::protobuf::Message& msg) {
+        std::string out;
+        if (wire_version.load(std::memory_order_relaxed) >= 2) {
+            out.reserve(wire::V2_HEADER_SIZE + msg.ByteSizeLong());
+            out.push_back(static_cast<char>(wire::V2));
+            out.push_back(static_cast<char>(type));
+            out.push_back(static_cast<char>(wire::FLAG_NONE));
+            out.push_back(0);
+            msg.AppendToString(&out);
+            if (wire::compression()) {
+                return wire::codec::local().compress(out);
+            }
+            return out;
+        }
+        Envelope env;
+        env.mutable_payload()->PackFrom(msg);
+        env.SerializeToString(&out);
+        return out;
+    }
+
+    void append_varint(std::string& out, uint64_t v) {
+        while (v >= 0x80) {
+            out.push_back(static_cast<char>(v | 0x80));
+            v >>= 7;
+        }
+        out.push_back(static_cast<char>(v));
+    }
+
+    // 长度分隔字段的tag + 长度, 内容由调用方接着写
+    void append_bytes_field(std::string& out, int field, size_t len) {
+        append_varint(out, (static_cast<uint64_t>(field) << 3) | 2);
+        append_varint(out, len);
+    }
+
+    bool read_varint(std::string_view& in, uint64_t& v) {
+        v = 0;
+        for (int shift = 0; shift < 64 && !in.empty(); shift += 7) {
+            auto b = static_cast<uint8_t>(in.front());
+            in.remove_prefix(1);
+            v |= static_cast<uint64_t>(b & 0x7F) << shift;
+            if (!(b & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // 读出下一个字段: 整数类放进value, 长度分隔的bytes指向in里的内容, 定长的跳过; 格式不对返回false
+    struct raw_field {
+        int number = 0;
+        uint64_t value = 0;
+        std::string_view bytes;
+    };
+
+    bool next_field(std::string_view& in, raw_field& f) {
+        uint64_t tag;
+        if (!read_varint(in, tag) || (tag >> 3) == 0) {
+            return false;
+        }
+        f.number = static_cast<int>(tag >> 3);
+        switch (tag & 7) {
+            case 0:
+                return read_varint(in, f.value);
+            case 1:
+            case 5: {
+                size_t n = (tag & 7) == 1 ? 8 : 4;
+                if (in.size() < n) {
+                    return false;
+                }
+                in.remove_prefix(n);
+                return true;
+            }
+            case 2:
+                if (!read_varint(in, f.value) || f.value > in.size()) {
+                    return false;
+                }
+                f.bytes = in.substr(0, f.value);
+                in.remove_prefix(f.value);
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // 两种格式都认, 类型不符时抛异常(与原来的UnpackTo失败一致)
+    template<typename T>
+    void unpack(const std::string& proto_str, DataType type, T& out, const char* name) {
+        wire::scratch sc;
+        std::string_view body;
+        DataType got = wire::decode(proto_str, body, sc);
+        if (got == DataType::None) {
+            throw std::runtime_error("Failed to parse Envelope from received data");
+        }
+        if (got != type || !out.ParseFromArray(body.data(), static_cast<int>(body.size()))) {
+            throw std::runtime_error(std::string("Failed to unpack Any to ") + name);
+        }
+    }
+}
+
+bool wire::is_v2(std::string_view frame) {
+    return frame.size() >= V2_HEADER_SIZE && static_cast<uint8_t>(frame[0]) == V2;
+}
+
+DataType wire::decode(std::string_view frame, std::string_view& body, scratch& sc, codec* c) {
+    if (is_compressed(frame)) {
+        if (!(c ? c : &codec::local())->decompress(frame, sc.plain)) {
+            return DataType::None;
+        }
+        frame = sc.plain;
+    }
+    if (is_v2(frame)) {
+        auto type = static_cast<DataType>(static_cast<uint8_t>(frame[1]));
+        if (type_url_of(type).empty()) {
+            return DataType::None;
+        }
+        body = frame.substr(V2_HEADER_SIZE);
+        return type;
+    }
+    // v1: Envelope{payload: Any{type_url, value}}, 按字段号直接找, 不建Envelope和Any
+    std::string_view any, url;
+    raw_field f;
+    while (!frame.empty()) {
+        if (!next_field(frame, f)) {
+            return DataType::None;
+        }
+        if (f.number == Envelope::kPayloadFieldNumber) {
+            any = f.bytes;
+        }
+    }
+    body = {};
+    while (!any.empty()) {
+        if (!next_field(any, f)) {
+            return DataType::None;
+        }
+        if (f.number == google::protobuf::Any::kTypeUrlFieldNumber) {
+            url = f.bytes;
+        } else if (f.number == google::protobuf::Any::kValueFieldNumber) {
+            body = f.bytes;
+        }
+    }
+    return type_of_url(url);
+}
+
+bool wire::chat_view::parse(std::string_view body) {
+    *this = chat_view{};
+    raw_field f;
+    while (!body.empty()) {
+        if (!next_field(body, f)) {
+            return false;
+        }
+        switch (f.number) {
+            case ChatMessage::kSenderFieldNumber:
+                sender = f.bytes;
+                break;
+            case ChatMessage::kReceiverFieldNumber:
+                receiver = f.bytes;
+                break;
+            case ChatMessage::kIsGroupFieldNumber:
+                is_group = f.value != 0;
+                break;
+            case ChatMessage::kTimestampFieldNumber:
+                timestamp = static_cast<std::int64_t>(f.value);
+                break;
+            default:
+                break; // 正文、附件等转发时原样带走
+        }
+    }
+    return true;
+}
+
+std::string wire::to_legacy(std::string_view frame) {
+    if (!is_v2(frame)) {
+        return std::string(frame);
+    }
+    std::string plain;
+    if (is_compressed(frame)) {
+        if (!codec::local().decompress(frame, plain)) {
+            return std::string();
+        }
+        frame = plain;
+    }
+    // 类型字节直接换成type_url, 消息体原样搬进Any, 不用解析
+    Envelope env;
+    auto any = env.mutable_payload();
+    any->set_type_url(type_url_of(static_cast<DataType>(static_cast<uint8_t>(frame[1]))));
+    any->set_value(frame.data() + V2_HEADER_SIZE, frame.size() - V2_HEADER_SIZE);
+    std::string out;
+    env.SerializeToString(&out);
+    return out;
+}
+
+void wire::set_version(int version) {
+    wire_version.store(version, std::memory_order_relaxed);
+}
+
+int wire::version() {
+    return wire_version.load(std::memory_order_relaxed);
+}
 
 /* ---------- ChatMessage ---------- */
 
@@ -34,13 +264,7 @@ ChatMessage create_chat_message(
 }
 
 std::string get_message_string(const ChatMessage& msg) {
-    google::protobuf::Any any;
-    any.PackFrom(msg);
-    Envelope env;
-    env.mutable_payload()->CopyFrom(any);
-    std::string env_out;
-    env.SerializeToString(&env_out);
-    return env_out;
+    return pack(DataType::Message, msg);
 }
 
 std::string create_message_string(
@@ -60,18 +284,11 @@ std::string create_message_string(
 }
 
 ChatMessage get_chat_message(const std::string& proto_str) {
-    Envelope env;
     if (proto_str.empty()) {
         return ChatMessage();
     }
-    if (!env.ParseFromString(proto_str)) {
-        throw std::runtime_error("Failed to parse Envelope from received data");
-    }
-    const google::protobuf::Any& any = env.payload();
     ChatMessage msg;
-    if (!any.UnpackTo(&msg)) {
-        throw std::runtime_error("Failed to unpack Any to ChatMessage");
-    }
+    unpack(proto_str, DataType::Message, msg, "ChatMessage");
     return msg;
 }
 
@@ -106,14 +323,7 @@ CommandRequest create_command(
 }
 
 std::string get_command_string(const CommandRequest& cmd) {
-    google::protobuf::Any any;
-    any.PackFrom(cmd);
-    Envelope env;
-    env.mutable_payload()->CopyFrom(any); // 只用 CopyFrom, 不要 PackFrom
-    //std::cout << "打包测试类型[" << env.payload().type_url() << "]" << std::endl; // 调试输出
-    std::string env_out;
-    env.SerializeToString(&env_out);
-    return env_out;
+    return pack(DataType::Command, cmd);
 }
 
 std::string create_command_string(
@@ -135,18 +345,11 @@ std::string create_command_string(
 }
 
 CommandRequest get_command_request(const std::string& proto_str) {
-    Envelope env;
     if (proto_str.empty()) {
         return CommandRequest();
     }
-    if (!env.ParseFromString(proto_str)) {
-        throw std::runtime_error("Failed to parse Envelope from received data");
-    }
-    const google::protobuf::Any& any = env.payload();
     CommandRequest cmd;
-    if (!any.UnpackTo(&cmd)) {
-        throw std::runtime_error("Failed to unpack Any to CommandRequest");
-    }
+    unpack(proto_str, DataType::Command, cmd, "CommandRequest");
     return cmd;
 }
 
@@ -169,13 +372,7 @@ FileChunk create_file_chunk(
 }
 
 std::string get_file_chunk_string(const FileChunk& chunk) {
-    google::protobuf::Any any;
-    any.PackFrom(chunk);
-    Envelope env;
-    env.mutable_payload()->CopyFrom(any);
-    std::string env_out;
-    env.SerializeToString(&env_out);
-    return env_out;
+    return pack(DataType::FileChunk, chunk);
 }
 
 std::string create_file_chunk_string(
@@ -190,18 +387,48 @@ std::string create_file_chunk_string(
 }
 
 FileChunk get_file_chunk(const std::string& proto_str) {
-    Envelope env;
-    if (!env.ParseFromString(proto_str)) {
-        throw std::runtime_error("Failed to parse Envelope from received data");
-    }
-    const google::protobuf::Any& any = env.payload();
     FileChunk chunk;
-    if (!any.UnpackTo(&chunk)) {
-        throw std::runtime_error("Failed to unpack Any to FileChunk");
-    }
+    unpack(proto_str, DataType::FileChunk, chunk, "FileChunk");
     return chunk;
 }
 
+std::string create_file_chunk_head(
+    const std::string& file_id,
+    size_t data_len,
+    size_t chunk_index,
+    size_t total_chunks,
+    bool is_last_chunk,
+    int version
+) {
+    // FileChunk = 其余字段 + data字段头, 数据本身由调用方接在后面
+    FileChunk meta = create_file_chunk(file_id, {}, chunk_index, total_chunks, is_last_chunk);
+    std::string body;
+    meta.SerializeToString(&body);
+    append_bytes_field(body, FileChunk::kDataFieldNumber, data_len);
+    size_t body_len = body.size() + data_len;
+
+    std::string out;
+    if (version >= 2) {
+        out.reserve(wire::V2_HEADER_SIZE + body.size());
+        out.push_back(static_cast<char>(wire::V2));
+        out.push_back(static_cast<char>(DataType::FileChunk));
+        out.push_back(static_cast<char>(wire::FLAG_NONE));
+        out.push_back(0);
+        out += body;
+        return out;
+    }
+    // v1: Envelope{payload: Any{type_url, value: body + 数据}}, 外层长度都能先算出来
+    const std::string& url = type_url_of(DataType::FileChunk);
+    std::string any;
+    append_bytes_field(any, google::protobuf::Any::kTypeUrlFieldNumber, url.size());
+    any += url;
+    append_bytes_field(any, google::protobuf::Any::kValueFieldNumber, body_len);
+    append_bytes_field(out, Envelope::kPayloadFieldNumber, any.size() + body_len);
+    out += any;
+    out += body;
+    return out;
+}
+
 /* ---------- SyncItem ---------- */
 
 SyncItem create_sync_item(
@@ -220,13 +447,7 @@ SyncItem create_sync_item(
 }
 
 std::string get_sync_string(const SyncItem& item) {
-    google::protobuf::Any any;
-    any.PackFrom(item);
-    Envelope env;
-    env.mutable_payload()->CopyFrom(any);
-    std::string env_out;
-    env.SerializeToString(&env_out);
-    return env_out;
+    return pack(DataType::SyncItem, item);
 }
 
 std::string create_sync_string(
@@ -239,15 +460,8 @@ std::string create_sync_string(
 }
 
 SyncItem get_sync_item(const std::string& proto_str) {
-    Envelope env;
-    if (!env.ParseFromString(proto_str)) {
-        throw std::runtime_error("Failed to parse Envelope from received data");
-    }
-    const google::protobuf::Any& any = env.payload();
     SyncItem item;
-    if (!any.UnpackTo(&item)) {
-        throw std::runtime_error("Failed to unpack Any to SyncItem");
-    }
+    unpack(proto_str, DataType::SyncItem, item, "SyncItem");
     return item;
 }
 
@@ -263,13 +477,7 @@ OfflineMessages create_offline_messages(const std::vector<ChatMessage>& messages
 }
 
 std::string get_offline_messages_string(const OfflineMessages& offline_msgs) {
-    google::protobuf::Any any;
-    any.PackFrom(offline_msgs);
-    Envelope env;
-    env.mutable_payload()->CopyFrom(any);
-    std::string env_out;
-    env.SerializeToString(&env_out);
-    return env_out;
+    return pack(DataType::OfflineMessages, offline_msgs);
 }
 
 std::string create_offline_messages_string(const std::vector<ChatMessage>& messages) {
@@ -278,14 +486,7 @@ std::string create_offline_messages_string(const std::vector<ChatMessage>& messa
 }
 
 OfflineMessages get_offline_messages(const std::string& proto_str) {
-    Envelope env;
-    if (!env.ParseFromString(proto_str)) {
-        throw std::runtime_error("Failed to parse Envelope from received data");
-    }
-    const google::protobuf::Any& any = env.payload();
     OfflineMessages offline_msgs;
-    if (!any.UnpackTo(&offline_msgs)) {
-        throw std::runtime_error("Failed to unpack Any to OfflineMessages");
-    }
+    unpack(proto_str, DataType::OfflineMessages, offline_msgs, "OfflineMessages");
     return offline_msgs;
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 #include <initializer_list>
 #include <string>
+#include <string_view>
 #include <google/protobuf/message.h>
 #include <google/protobuf/any.pb.h>
 #include "envelope.pb.h"
@@ -107,6 +108,17 @@ std::string create_file_chunk_string(
 
 FileChunk get_file_chunk(const std::string& proto_str);
 
+// 文件分片帧的前半段, 后面紧跟data_len字节文件数据就是完整的一帧(按version选v1/v2)
+// data字段放在最后(protobuf不要求字段顺序), 数据不进protobuf, 发送方可以直接sendfile
+std::string create_file_chunk_head(
+    const std::string& file_id,
+    size_t data_len,
+    size_t chunk_index,
+    size_t total_chunks,
+    bool is_last_chunk,
+    int version
+);
+
 /* ---------- SyncItem ----------*/
 
 SyncItem create_sync_item(
@@ -133,4 +145,54 @@ std::string get_offline_messages_string(const OfflineMessages& offline_msgs);
 
 std::string create_offline_messages_string(const std::vector<ChatMessage>& messages);
 
-OfflineMessages get_offline_messages(const std::string& proto_str);
\ No newline at end of file
+OfflineMessages get_offline_messages(const std::string& proto_str);
+
+/* ---------- Wire format ---------- */
+
+/*
+    两种帧格式并存(都在4字节长度头之内):
+    - v1: 序列化的Envelope, 载荷是Any; 首字节只会是0x0A(user_id)或0x12(payload)
+    - v2: [0x02][类型(DataType)][flags][保留] + 具体消息的序列化
+      直接按类型字节查表, 不比较type_url, 载荷也只解析一次
+    v2要在连接上协商(Action::Wire_Version)之后才发, 收方两种格式都认
+*/
+namespace wire {
+    constexpr uint8_t V2 = 0x02;
+    constexpr size_t V2_HEADER_SIZE = 4;
+    constexpr uint8_t FLAG_NONE = 0x00;
+    constexpr uint8_t FLAG_ZSTD = 0x01; // 载荷经zstd压缩(见wire_codec.hpp)
+
+    bool is_v2(std::string_view frame);
+
+    class codec;
+    // 解帧时的临时存放处, 循环里复用可以少分配
+    // protobuf的Clear()不释放字符串和repeated字段的容量, 每个线程留一份反复解析, 稳定后不再分配
+    struct scratch {
+        std::string plain; // 压缩帧解压后的v2帧
+        CommandRequest cmd;
+        FileChunk chunk;
+    };
+
+    // ChatMessage的只读视图, 字符串字段直接指向body里的字节, 解析不分配内存
+    // 服务器转发消息只看这几个字段, 正文和附件信息不解析; body要比视图活得久
+    struct chat_view {
+        std::string_view sender;
+        std::string_view receiver;
+        bool is_group = false;
+        std::int64_t timestamp = 0;
+
+        bool parse(std::string_view body);
+    };
+
+    // 拆出类型和具体消息的字节, 不认识/解析失败返回DataType::None
+    // body指向frame里的数据(压缩帧指向sc.plain), 不拷贝; c为空时用线程局部的解压上下文
+    DataType decode(std::string_view frame, std::string_view& body, scratch& sc, codec* c = nullptr);
+
+    // v2帧转回v1(压缩的先解压), 发给没协商的对端; v1帧原样返回
+    std::string to_legacy(std::string_view frame);
+
+    // 本进程get_*_string()产出的版本, 默认1; 是否压缩见wire::set_compression()
+    // 客户端协商成功后切到2; 服务端不切, 是否发v2按连接决定
+    void set_version(int version);
+    int version();
+}
@@ -0,0 +1,104 @@
+#include "wire_codec.hpp"
+#include "datatypes.hpp"
+#include <atomic>
+#ifdef CHATROOM_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+namespace {
+    std::atomic<bool> compress_on{false};
+}
+
+bool wire::available() {
+#ifdef CHATROOM_WITH_ZSTD
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool wire::is_compressed(std::string_view frame) {
+    return is_v2(frame) && (static_cast<uint8_t>(frame[2]) & FLAG_ZSTD);
+}
+
+wire::codec::~codec() {
+#ifdef CHATROOM_WITH_ZSTD
+    ZSTD_freeCCtx(static_cast<ZSTD_CCtx*>(cctx));
+    ZSTD_freeDCtx(static_cast<ZSTD_DCtx*>(dctx));
+#endif
+}
+
+std::string wire::codec::compress(std::string_view frame) {
+#ifdef CHATROOM_WITH_ZSTD
+    if (!is_v2(frame) || is_compressed(frame) || frame.size() < COMPRESS_MIN
+        || static_cast<uint8_t>(frame[1]) == static_cast<uint8_t>(DataType::FileChunk)) {
+        return std::string(frame);
+    }
+    std::string_view body = frame.substr(V2_HEADER_SIZE);
+    std::string out(V2_HEADER_SIZE + ZSTD_compressBound(body.size()), '\0');
+    size_t n;
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        if (!cctx) {
+            cctx = ZSTD_createCCtx();
+        }
+        n = ZSTD_compressCCtx(static_cast<ZSTD_CCtx*>(cctx), out.data() + V2_HEADER_SIZE, out.size() - V2_HEADER_SIZE,
+                              body.data(), body.size(), 1); // 低级别, 要的是省带宽不是压缩比
+    }
+    if (ZSTD_isError(n) || n >= body.size()) {
+        return std::string(frame);
+    }
+    out.resize(V2_HEADER_SIZE + n);
+    out.replace(0, V2_HEADER_SIZE, frame.data(), V2_HEADER_SIZE);
+    out[2] = static_cast<char>(static_cast<uint8_t>(out[2]) | FLAG_ZSTD);
+    return out;
+#else
+    return std::string(frame);
+#endif
+}
+
+bool wire::codec::decompress(std::string_view frame, std::string& out) {
+#ifdef CHATROOM_WITH_ZSTD
+    if (!is_compressed(frame)) {
+        return false;
+    }
+    std::string_view body = frame.substr(V2_HEADER_SIZE);
+    unsigned long long size = ZSTD_getFrameContentSize(body.data(), body.size());
+    if (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN || size > DECOMPRESS_MAX) {
+        return false;
+    }
+    out.resize(V2_HEADER_SIZE + size);
+    size_t n;
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        if (!dctx) {
+            dctx = ZSTD_createDCtx();
+        }
+        n = ZSTD_decompressDCtx(static_cast<ZSTD_DCtx*>(dctx), out.data() + V2_HEADER_SIZE, size,
+                                body.data(), body.size());
+    }
+    if (ZSTD_isError(n) || n != size) {
+        return false;
+    }
+    out.replace(0, V2_HEADER_SIZE, frame.data(), V2_HEADER_SIZE);
+    out[2] = static_cast<char>(static_cast<uint8_t>(out[2]) & ~FLAG_ZSTD);
+    return true;
+#else
+    (void)frame;
+    (void)out;
+    return false;
+#endif
+}
+
+wire::codec& wire::codec::local() {
+    thread_local codec c;
+    return c;
+}
+
+void wire::set_compression(bool on) {
+    compress_on.store(on && available(), std::memory_order_relaxed);
+}
+
+bool wire::compression() {
+    return compress_on.load(std::memory_order_relaxed);
+}
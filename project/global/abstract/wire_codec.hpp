@@ -0,0 +1,46 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <string_view>
+
+/*
+    v2帧的载荷压缩(zstd), 头部flags带FLAG_ZSTD, 头部本身不压
+    - 只压超过COMPRESS_MIN的帧, 压不小就原样发; 文件分片不压
+    - 压缩上下文每连接一个反复用, 不用每帧重新分配;
+      没有连接归属的地方(解析缓存、客户端)用线程局部的那个
+    - 编译时没带zstd(CHATROOM_WITH_ZSTD)时available()为false, 不会协商出压缩,
+      收到压缩帧解不开按坏帧处理
+*/
+namespace wire {
+    constexpr size_t COMPRESS_MIN = 1024;
+    constexpr size_t DECOMPRESS_MAX = 64 * 1024 * 1024; // 防解压炸弹
+    constexpr const char* CODEC_NAME = "zstd";
+
+    bool available();
+    bool is_compressed(std::string_view frame);
+
+    class codec {
+    public:
+        codec() = default;
+        ~codec();
+        codec(const codec&) = delete;
+        codec& operator=(const codec&) = delete;
+
+        // 未压缩的v2帧且够大时压缩, 其余原样返回
+        std::string compress(std::string_view frame);
+        // 压缩帧还原成普通v2帧, 失败返回false
+        bool decompress(std::string_view frame, std::string& out);
+
+        static codec& local();
+
+    private:
+        std::mutex m_Mutex;
+        void* cctx = nullptr;
+        void* dctx = nullptr;
+    };
+
+    // 开关本进程get_*_string()产出时是否压缩(客户端协商成功后打开)
+    void set_compression(bool on);
+    bool compression();
+}
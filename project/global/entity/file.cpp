@@ -321,7 +321,7 @@ bool ServerFile::open_for_write() {
     return true;
 }
 
-bool ServerFile::write_chunk(const std::vector<char>& data, size_t chunk_index) {
+bool ServerFile::write_chunk(std::string_view data, size_t chunk_index) {
     if (!output_stream.is_open()) {
         log_error("Output stream not open for server file: {}", file_name);
         return false;
@@ -75,4 +75,6 @@ enum class Action {
     Remember_Connection,   // 记住连接 --idx
     Online_Init,           // 在线初始化
     HEARTBEAT,             // 心跳检测
+    Mux_Connection,        // 切换为单连接复用模式, 之后的帧都带通道头(见mux_frame.hpp)
+    Wire_Version,          // 协商帧格式版本, args: [版本, 逻辑服务器下标, 支持的压缩算法]
 };
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+    全局operator new计数, 用来确认热路径上有没有堆分配
+    - 配置时加-DCOUNT_ALLOCS=ON才编进来(定义CHATROOM_COUNT_ALLOCS), 替换全局operator new,
+      每个线程一个计数器, 分配一次加一, 不加锁
+    - alloc_counter::scope记下构造时的计数, since()是这之后本线程分配了几次
+    - 没打开时enabled为false, 计数恒为0, 不影响正常构建
+*/
+namespace alloc_counter {
+#ifdef CHATROOM_COUNT_ALLOCS
+    constexpr bool enabled = true;
+    std::uint64_t thread_count();
+#else
+    constexpr bool enabled = false;
+    inline std::uint64_t thread_count() { return 0; }
+#endif
+
+    class scope {
+    public:
+        scope() : start(thread_count()) {}
+        std::uint64_t since() const { return thread_count() - start; }
+
+    private:
+        std::uint64_t start;
+    };
+}
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include "threadpool.hpp"
+#include "logging.hpp"
+
+/*
+    跑在thread_pool上的协程
+    - co_task<T>是惰性的: 创建时不执行, 被co_await时才开始, 结束后直接切回等待它的协程
+    - co_spawn()把一个co_task<>放出去独立执行, 结束(包括抛异常)后调用on_done
+    - co_await run_blocking(pool, fn): 把fn(查库、发邮件之类的阻塞调用)投到pool执行,
+      当前协程挂起, 不占worker; fn做完后协程回到挂起前所在的线程池继续, 优先级不变.
+      pool排满了或者为空时fn就地执行, 协程不挂起
+    - 协程的参数会拷进协程帧, 引用参数要保证在协程结束前有效, 所以对外的协程函数都按值传参
+*/
+
+template<typename T = void>
+class co_task;
+
+namespace co_detail {
+    template<typename T>
+    struct promise_result {
+        std::optional<T> value;
+        void return_value(T v) { value.emplace(std::move(v)); }
+        T take() { return std::move(*value); }
+    };
+
+    template<>
+    struct promise_result<void> {
+        void return_void() noexcept {}
+        void take() noexcept {}
+    };
+
+    // co_spawn用的驱动协程, 开始就执行, 结束自己销毁
+    struct detached {
+        struct promise_type {
+            detached get_return_object() noexcept { return {}; }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() noexcept {}
+            void unhandled_exception() noexcept { std::terminate(); }
+        };
+    };
+}
+
+template<typename T>
+class co_task {
+public:
+    struct promise_type : co_detail::promise_result<T> {
+        std::coroutine_handle<> continuation;
+        std::exception_ptr error;
+
+        co_task get_return_object() noexcept {
+            return co_task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        struct final_awaiter {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+                auto cont = h.promise().continuation;
+                return cont ? cont : std::noop_coroutine();
+            }
+            void await_resume() noexcept {}
+        };
+        final_awaiter final_suspend() noexcept { return {}; }
+
+        void unhandled_exception() noexcept { error = std::current_exception(); }
+    };
+
+    co_task(co_task&& other) noexcept : h(std::exchange(other.h, nullptr)) {}
+    co_task& operator=(co_task&& other) noexcept {
+        if (this != &other) {
+            if (h) {
+                h.destroy();
+            }
+            h = std::exchange(other.h, nullptr);
+        }
+        return *this;
+    }
+    co_task(const co_task&) = delete;
+    co_task& operator=(const co_task&) = delete;
+
+    ~co_task() {
+        if (h) {
+            h.destroy();
+        }
+    }
+
+    auto operator co_await() && noexcept {
+        struct awaiter {
+            std::coroutine_handle<promise_type> h;
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> cont) noexcept {
+                h.promise().continuation = cont;
+                return h; // 对称转移, 链再长也不会爆栈
+            }
+            T await_resume() {
+                if (h.promise().error) {
+                    std::rethrow_exception(h.promise().error);
+                }
+                return h.promise().take();
+            }
+        };
+        return awaiter{h};
+    }
+
+private:
+    explicit co_task(std::coroutine_handle<promise_type> h) noexcept : h(h) {}
+
+    std::coroutine_handle<promise_type> h;
+};
+
+namespace co_detail {
+    inline detached drive(co_task<> task, unique_task on_done) {
+        try {
+            co_await std::move(task);
+        } catch (const std::exception& e) {
+            log_error("Unhandled exception in coroutine: {}", e.what());
+        } catch (...) {
+            log_error("Unhandled unknown exception in coroutine");
+        }
+        if (on_done) {
+            on_done();
+        }
+    }
+}
+
+// 在当前线程开始执行task, 第一次挂起时返回
+inline void co_spawn(co_task<> task, unique_task on_done = {}) {
+    co_detail::drive(std::move(task), std::move(on_done));
+}
+
+template<typename F>
+class blocking_awaiter {
+    using result_type = std::invoke_result_t<F&>;
+    using storage = std::conditional_t<std::is_void_v<result_type>, bool, std::optional<result_type>>;
+
+public:
+    blocking_awaiter(thread_pool* pool, F fn) : pool(pool), fn(std::move(fn)) {}
+
+    bool await_ready() const noexcept { return pool == nullptr; }
+
+    bool await_suspend(std::coroutine_handle<> h) {
+        thread_pool* back = thread_pool::current();
+        thread_pool::Priority pri = thread_pool::current_priority();
+        unique_task job([this, h, back, pri] {
+            invoke();
+            if (back) {
+                back->post([h] { h.resume(); }, pri);
+            } else {
+                h.resume();
+            }
+        });
+        // 投出去之后协程可能已经在别的线程恢复, 不能再碰this
+        return pool->try_post(std::move(job));
+    }
+
+    result_type await_resume() {
+        if (!done) {
+            invoke(); // 没挂起, 就地执行
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        if constexpr (!std::is_void_v<result_type>) {
+            return std::move(*result);
+        }
+    }
+
+private:
+    void invoke() noexcept {
+        try {
+            if constexpr (std::is_void_v<result_type>) {
+                fn();
+            } else {
+                result.emplace(fn());
+            }
+        } catch (...) {
+            error = std::current_exception();
+        }
+        done = true;
+    }
+
+    thread_pool* pool;
+    F fn;
+    storage result{};
+    std::exception_ptr error;
+    bool done = false;
+};
+
+template<typename F>
+blocking_awaiter<std::decay_t<F>> run_blocking(thread_pool* pool, F&& fn) {
+    return blocking_awaiter<std::decay_t<F>>(pool, std::forward<F>(fn));
+}
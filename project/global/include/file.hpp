@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <memory>
 #include <fstream>
 #include <vector>
@@ -94,7 +95,7 @@ public:
 
     // 接收文件相关
     bool open_for_write();
-    bool write_chunk(const std::vector<char>& data, size_t chunk_index);
+    bool write_chunk(std::string_view data, size_t chunk_index);
     bool is_complete() const;
     bool finalize_upload();
 
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include "threadpool.hpp"
+
+/*
+    串行执行器, 建在thread_pool上
+    - 同一个strand上post的任务按提交顺序一个接一个执行, 任务之间不会并发,
+      处理函数里不用再为这个strand的状态加锁
+    - 不同strand互不影响, 在线程池里并行
+    - 任务排在无锁的多生产者单消费者队列里(Vyukov), 队列从空变非空时
+      才往线程池投一个run(), 由它连续执行排着的任务
+    - 一次run()最多连续执行BATCH_LIMIT个, 还有剩的就重新投递, 不长期霸占worker
+    - 投到线程池时用构造时给的优先级
+    - strand必须比投给它的任务活得久; 析构时还没执行的任务直接丢弃
+*/
+class strand {
+public:
+    explicit strand(thread_pool* pool, thread_pool::Priority pri = thread_pool::Priority::Normal)
+        : pool(pool), pri(pri) {}
+    strand(const strand&) = delete;
+    strand& operator=(const strand&) = delete;
+
+    ~strand() {
+        while (task_node* n = pop()) {
+            task_node_cache::release(n);
+        }
+    }
+
+    void post(unique_task fn) {
+        task_node* n = task_node_cache::acquire();
+        n->fn = std::move(fn);
+        push(n);
+        // 计数在入队之后加, run()看到计数时节点一定已经链上
+        if (pending.fetch_add(1, std::memory_order_acq_rel) == 0) {
+            pool->post([this] { run(); }, pri);
+        }
+    }
+
+private:
+    static constexpr int BATCH_LIMIT = 64;
+
+    thread_pool* pool;
+    thread_pool::Priority pri;
+    std::atomic<size_t> pending{0};
+    task_node stub;
+    std::atomic<task_node*> head{&stub}; // 生产者端
+    task_node* tail = &stub;             // 消费者端, 同一时刻只有一个run()在用
+
+    void push(task_node* n) {
+        n->next.store(nullptr, std::memory_order_relaxed);
+        task_node* prev = head.exchange(n, std::memory_order_acq_rel);
+        prev->next.store(n, std::memory_order_release);
+    }
+
+    // 仅消费者调用; 有生产者交换了head但还没链上时返回nullptr
+    task_node* pop() {
+        task_node* t = tail;
+        task_node* next = t->next.load(std::memory_order_acquire);
+        if (t == &stub) {
+            if (!next) {
+                return nullptr;
+            }
+            tail = next;
+            t = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+        if (next) {
+            tail = next;
+            return t;
+        }
+        if (t != head.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        push(&stub);
+        next = t->next.load(std::memory_order_acquire);
+        if (next) {
+            tail = next;
+            return t;
+        }
+        return nullptr;
+    }
+
+    void run() {
+        for (int i = 0; i < BATCH_LIMIT; ++i) {
+            task_node* n;
+            while (!(n = pop())) {
+                std::this_thread::yield(); // 生产者正链到一半, 马上就好
+            }
+            n->fn();
+            task_node_cache::release(n);
+            if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                return;
+            }
+        }
+        pool->post([this] { run(); }, pri);
+    }
+};
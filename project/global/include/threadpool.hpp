@@ -6,53 +6,199 @@
 #include <functional>
 #include <future>
 #include <vector>
-#include "safe_queue.hpp"
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include <tuple>
+#include <iterator>
+#include "ws_deque.hpp"
+#include "unique_task.hpp"
+
+/*
+    工作窃取线程池
+    - 每个worker一个Chase-Lev双端队列, worker里submit的任务放进自己的队列,
+      由自己后进先出地取, 数据还热在缓存里
+    - 外部线程submit的任务进全局注入队列(一把锁), worker本地取空后
+      从这里批量搬一些到自己队列
+    - 还没活干就随机挑别的worker从队列顶部偷
+    - 都空了才睡眠; submit时只有存在睡眠的worker才去加锁唤醒,
+      且一次只叫醒一个, 由它拿到活后接力
+    - 任务是unique_task, 装在复用的task_node里; post()不建future,
+      小闭包从提交到执行完不分配内存
+    - 任务分三个优先级, 每级各有本地队列和注入队列:
+        Critical 登录、心跳等命令, 排队时间直接影响体验
+        Normal   聊天消息收发等一般事件
+        Bulk     文件分片读写、定时批量入库这类大块活
+      worker按8:4:1加权轮转决定先看哪一级, 看的那级空了再按优先级往下找,
+      有活时不闲着; 低优先级在高优先级一直有活时也能按权重分到份额
+    - 同时执行Bulk的worker不超过一半, 大文件下载再多也总有worker空出来处理登录
+    - 可以给排队任务数设上限, try_post()超过上限时拒收, 由调用方自己兜底;
+      post()/submit()不受上限约束
+*/
+
+// 排在队列里的任务节点
+struct task_node {
+    unique_task fn;
+    std::atomic<task_node*> next{nullptr}; // 空闲链表里单线程用, strand的无锁队列里多线程用
+};
+
+/*
+    task_node的空闲链表
+    - 每个线程缓存一些, 取还都不加锁
+    - 本线程缓存空了从全局取一整批, 攒多了整批还给全局, 一批只加一次锁
+    - reactor线程只取不还、worker只还不取的情况下, 节点经全局链表流转回来
+*/
+class task_node_cache {
+public:
+    static task_node* acquire() {
+        auto& lc = local();
+        if (!lc.head) {
+            lc.head = global().take(lc.count);
+            if (!lc.head) {
+                return new task_node;
+            }
+        }
+        task_node* n = lc.head;
+        lc.head = n->next.load(std::memory_order_relaxed);
+        --lc.count;
+        n->next.store(nullptr, std::memory_order_relaxed);
+        return n;
+    }
+
+    static void release(task_node* n) {
+        n->fn.reset();
+        auto& lc = local();
+        n->next.store(lc.head, std::memory_order_relaxed);
+        lc.head = n;
+        if (++lc.count >= 2 * BATCH) {
+            // 前BATCH个留下, 后面的整批交出去
+            task_node* tail = lc.head;
+            for (size_t i = 1; i < BATCH; ++i) {
+                tail = tail->next.load(std::memory_order_relaxed);
+            }
+            global().give(tail->next.load(std::memory_order_relaxed), lc.count - BATCH);
+            tail->next.store(nullptr, std::memory_order_relaxed);
+            lc.count = BATCH;
+        }
+    }
 
-class thread_pool {
 private:
-    /* ------------------------------------------- */
-    class thread_worker {
-    private:
-        thread_pool* pool_ptr;
-        int m_Id;
-        std::thread m_Thread;
-
-    public:
-        bool isWorking;
-        bool terminate;
-
-        thread_worker(thread_pool* pool, int id) : pool_ptr(pool), m_Id(id) {}
-
-        void operator()() {
-            while (pool_ptr->pool_status <= 1) {
-                std::function<void()> func;
-                {
-                    std::unique_lock<std::mutex> lock(pool_ptr->m_Mutex);
-                    pool_ptr->m_Condition.wait(lock, [&]{
-                        return pool_ptr->pool_status == 1 || !pool_ptr->m_TaskQueue.empty();
-                    });
-                    if (pool_ptr->pool_status == 1 && pool_ptr->m_TaskQueue.empty())
-                        return;
-                    if (!pool_ptr->m_TaskQueue.pop(func))
-                        continue;
+    static constexpr size_t BATCH = 64;
+    static constexpr size_t MAX_GLOBAL_BATCHES = 1024; // 再多就直接释放
+
+    static void free_list(task_node* n) {
+        while (n) {
+            task_node* next = n->next.load(std::memory_order_relaxed);
+            delete n;
+            n = next;
+        }
+    }
+
+    struct global_list {
+        std::mutex m_Mutex;
+        std::vector<std::pair<task_node*, size_t>> batches;
+
+        task_node* take(size_t& count) {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            if (batches.empty()) {
+                return nullptr;
+            }
+            auto [head, n] = batches.back();
+            batches.pop_back();
+            count = n;
+            return head;
+        }
+
+        void give(task_node* head, size_t count) {
+            {
+                std::lock_guard<std::mutex> lock(m_Mutex);
+                if (batches.size() < MAX_GLOBAL_BATCHES) {
+                    batches.emplace_back(head, count);
+                    return;
                 }
-                func();
+            }
+            free_list(head);
+        }
+    };
+
+    struct local_list {
+        task_node* head = nullptr;
+        size_t count = 0;
+
+        ~local_list() {
+            if (head) {
+                global().give(head, count);
             }
         }
     };
-    /* ------------------------------------------- */
-    safe_queue<std::function<void()>> m_TaskQueue;
-    std::vector<std::thread> m_Workers;
+
+    // 故意不析构, 线程退出时的local_list还要往里还
+    static global_list& global() {
+        static global_list* g = new global_list;
+        return *g;
+    }
+
+    static local_list& local() {
+        static thread_local local_list lc;
+        return lc;
+    }
+};
+
+class thread_pool {
 public:
-    std::mutex m_Mutex;
+    enum class Priority {
+        Critical = 0,
+        Normal = 1,
+        Bulk = 2
+    };
+    static constexpr int PRIORITY_NUM = 3;
+
+private:
+    using task = task_node;
+
+    struct worker {
+        ws_deque<task*> local[PRIORITY_NUM];
+        std::thread thread;
+        uint32_t seed;
+        unsigned turn = 0; // 加权轮转走到第几格
+    };
+
+    // 8:4:1, 打散排开, 免得连续几次都先看同一级
+    static constexpr Priority SCHEDULE[] = {
+        Priority::Critical, Priority::Normal, Priority::Critical, Priority::Critical,
+        Priority::Normal, Priority::Critical, Priority::Bulk, Priority::Critical,
+        Priority::Normal, Priority::Critical, Priority::Critical, Priority::Normal,
+        Priority::Critical
+    };
+
+    static constexpr size_t INJECT_BATCH = 16; // 一次从注入队列最多搬多少个到本地
+
+    // 当前线程所属的池和worker, 不是worker线程时为空
+    static inline thread_local thread_pool* tls_pool = nullptr;
+    static inline thread_local worker* tls_worker = nullptr;
+    static inline thread_local Priority tls_pri = Priority::Normal; // 正在执行的任务的优先级
+
+    std::vector<std::unique_ptr<worker>> m_Workers;
+    std::mutex m_Mutex;             // 保护注入队列
+    std::deque<task*> m_Inject[PRIORITY_NUM];
+    std::atomic<size_t> inject_size[PRIORITY_NUM] = {};
+    std::atomic<int> bulk_running{0};
+    int max_bulk = 1;
+    std::mutex park_mutex;          // 保护wake_seq
     std::condition_variable m_Condition;
+    std::atomic<int> idle{0};       // 正在准备睡眠或已睡眠的worker数
+    std::atomic<bool> waking{false}; // 已叫醒一个worker, 它还没找到活
+    uint64_t wake_seq = 0;
+    size_t queue_limit = 0;          // 排队任务数上限, 0表示不限
+    std::atomic<size_t> queued{0};   // 已提交还没开始执行的任务数, 设了上限才维护
+
+public:
     int pool_core_size;
-    //int pool_max_size;
-    int pool_status = 0; // 0: working, 1: shutdown, 2: stop, 3: tidying, 4: terminated
-    bool is_shutting_down = false;
+    std::atomic<int> pool_status{0}; // 0: working, 1: shutdown, 2: stop, 3: tidying, 4: terminated
 
-    thread_pool(int core_size = 4/*, int max_size = 8*/ )
-        : pool_core_size(core_size) {}
+    thread_pool(int core_size = 4, size_t queue_limit = 0)
+        : queue_limit(queue_limit), pool_core_size(core_size > 0 ? core_size : 1) {}
 
     thread_pool(const thread_pool&) = delete;
     thread_pool& operator=(const thread_pool&) = delete;
@@ -66,60 +212,301 @@ public:
 
     void init() {
         pool_status = 0;
+        max_bulk = std::max(1, pool_core_size / 2);
+        // 先把所有队列建好, 窃取时会遍历m_Workers
         for (int i = 0; i < pool_core_size; ++i) {
-            m_Workers.push_back(std::thread(thread_worker(this, i)));
+            auto w = std::make_unique<worker>();
+            w->seed = static_cast<uint32_t>(i) * 2654435761u + 1;
+            m_Workers.push_back(std::move(w));
+        }
+        for (int i = 0; i < pool_core_size; ++i) {
+            m_Workers[i]->thread = std::thread(&thread_pool::run_worker, this, i);
         }
     }
 
+    // 不再接收新任务, 已提交的做完再退出
     void shutdown() {
         pool_status = 1;
-        m_Condition.notify_all();
-        for (auto& worker : m_Workers) {
-            if (worker.joinable()) {
-                worker.join();
-            }
-        }
+        join_all();
         tidy();
     }
 
+    // 不再接收新任务, 正在做的做完就退出, 没做的丢弃
     void stop() {
         pool_status = 2;
-        m_Condition.notify_all(); // 必须唤醒所有worker
-        for (auto& worker : m_Workers) {
-            if (worker.joinable()) {
-                worker.join();
-            }
-        }
+        join_all();
         tidy();
     }
 
     void tidy() {
         pool_status = 3;
+        for (auto& w : m_Workers) {
+            for (auto& q : w->local) {
+                while (task* t = q.pop()) {
+                    task_node_cache::release(t);
+                }
+            }
+        }
         m_Workers.clear();
-        m_TaskQueue.clear();
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        for (int p = 0; p < PRIORITY_NUM; ++p) {
+            for (task* t : m_Inject[p]) {
+                task_node_cache::release(t);
+            }
+            m_Inject[p].clear();
+            inject_size[p] = 0;
+        }
+        queued = 0;
+    }
+
+    // 只管执行, 不要结果; 服务器事件分发等热路径用这个
+    void post(unique_task fn, Priority pri = Priority::Normal) {
+        if (pool_status != 0) {
+            return;
+        }
+        if (queue_limit) {
+            queued.fetch_add(1, std::memory_order_relaxed);
+        }
+        task* t = task_node_cache::acquire();
+        t->fn = std::move(fn);
+        enqueue(t, static_cast<int>(pri));
+    }
+
+    // 排队数到了上限或池子不在运行时返回false, 此时fn原样留给调用方
+    bool try_post(unique_task&& fn, Priority pri = Priority::Normal) {
+        if (pool_status != 0) {
+            return false;
+        }
+        if (queue_limit && queued.fetch_add(1, std::memory_order_relaxed) >= queue_limit) {
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+        }
+        task* t = task_node_cache::acquire();
+        t->fn = std::move(fn);
+        enqueue(t, static_cast<int>(pri));
+        return true;
+    }
+
+    size_t queued_tasks() const {
+        return queued.load(std::memory_order_relaxed);
+    }
+
+    // 当前线程所属的池, 不是worker线程时为空; 协程挂起后靠它回到原来的池子
+    static thread_pool* current() {
+        return tls_pool;
+    }
+
+    static Priority current_priority() {
+        return tls_pri;
     }
 
     template<typename F, typename... Args>
     auto submit(F&& f, Args&&... args) -> std::future<decltype(std::forward<F>(f)(std::forward<Args>(args)...))> {
         using return_type = decltype(std::forward<F>(f)(std::forward<Args>(args)...));
-        std::function<return_type()> task_func = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
-        auto task_ptr = std::make_shared<std::packaged_task<return_type()>>(task_func);
-        std::function<void()> l_func = [task_ptr]() {
-            (*task_ptr)();
-        };
         if (pool_status != 0) {
             return std::future<return_type>();
         }
-        m_TaskQueue.push(l_func);
-        m_Condition.notify_one();
-        return task_ptr->get_future();
+        // 参数按左值传, 和原来std::bind的行为一致
+        std::packaged_task<return_type()> task_func(
+            [f = std::forward<F>(f), args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+                return std::apply(f, args);
+            });
+        auto fut = task_func.get_future();
+        post([task_func = std::move(task_func)]() mutable {
+            task_func();
+        });
+        return fut;
     }
 
     void submit(std::function<void()> func) {
-        if (pool_status != 0) {
-            return;
+        post(std::move(func));
+    }
+
+private:
+    void enqueue(task* t, int pri) {
+        if (tls_pool == this && tls_worker) {
+            tls_worker->local[pri].push(t);
+        } else {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_Inject[pri].push_back(t);
+            inject_size[pri].fetch_add(1, std::memory_order_relaxed);
+        }
+        // 和worker睡前的idle++/再扫一遍配对, 两边至少有一边能看到对方
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        notify_idle();
+    }
+
+    // 同一时刻最多一个被唤醒的worker在找活, 它拿到活后再接力唤醒下一个,
+    // 免得每次submit都把睡着的worker全叫起来空扫一遍
+    void notify_idle() {
+        if (idle.load(std::memory_order_seq_cst) > 0 && !waking.exchange(true)) {
+            wake_one();
+        }
+    }
+
+    bool has_pending(worker* w) const {
+        for (int p = 0; p < PRIORITY_NUM; ++p) {
+            if (!w->local[p].empty() || inject_size[p].load(std::memory_order_relaxed) > 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void wake_one() {
+        {
+            std::lock_guard<std::mutex> lock(park_mutex);
+            ++wake_seq;
         }
-        m_TaskQueue.push(std::move(func));
         m_Condition.notify_one();
     }
+
+    void join_all() {
+        {
+            std::lock_guard<std::mutex> lock(park_mutex);
+            ++wake_seq;
+        }
+        m_Condition.notify_all(); // 必须唤醒所有worker
+        for (auto& w : m_Workers) {
+            if (w->thread.joinable()) {
+                w->thread.join();
+            }
+        }
+    }
+
+    task* take_injected(worker* w, int pri) {
+        if (inject_size[pri].load(std::memory_order_relaxed) == 0) {
+            return nullptr;
+        }
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        auto& q = m_Inject[pri];
+        if (q.empty()) {
+            return nullptr;
+        }
+        task* t = q.front();
+        q.pop_front();
+        // 按worker数均分, 多搬的倒序压进本地队列, 后进先出取时仍是提交顺序
+        size_t n = std::min(q.size() / m_Workers.size(), INJECT_BATCH);
+        for (size_t i = n; i > 0; --i) {
+            w->local[pri].push(q[i - 1]);
+        }
+        q.erase(q.begin(), q.begin() + n);
+        inject_size[pri].fetch_sub(n + 1, std::memory_order_relaxed);
+        return t;
+    }
+
+    task* steal_from_others(worker* w, int id, int pri) {
+        size_t n = m_Workers.size();
+        // xorshift随机起点, 免得大家都先去偷同一个
+        w->seed ^= w->seed << 13;
+        w->seed ^= w->seed >> 17;
+        w->seed ^= w->seed << 5;
+        size_t start = w->seed % n;
+        for (size_t i = 0; i < n; ++i) {
+            size_t v = (start + i) % n;
+            if (static_cast<int>(v) == id) {
+                continue;
+            }
+            auto& victim = m_Workers[v]->local[pri];
+            while (!victim.empty()) {
+                if (task* t = victim.steal()) {
+                    return t;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    // 找一个任务, pri带回它的优先级
+    task* find_task(worker* w, int id, int& pri) {
+        // 轮到的那级排第一, 其余按优先级高低
+        int order[PRIORITY_NUM];
+        order[0] = static_cast<int>(SCHEDULE[w->turn++ % std::size(SCHEDULE)]);
+        for (int p = 0, k = 1; p < PRIORITY_NUM; ++p) {
+            if (p != order[0]) {
+                order[k++] = p;
+            }
+        }
+        bool bulk_full = bulk_running.load(std::memory_order_relaxed) >= max_bulk;
+        // 先本地, 再注入队列, 最后去偷, 每一步都按上面的顺序
+        for (int step = 0; step < 3; ++step) {
+            for (int p : order) {
+                if (p == static_cast<int>(Priority::Bulk) && bulk_full) {
+                    continue;
+                }
+                task* t = step == 0 ? w->local[p].pop()
+                        : step == 1 ? take_injected(w, p)
+                        : steal_from_others(w, id, p);
+                if (t) {
+                    pri = p;
+                    return t;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    void run_task(task* t, int pri) {
+        if (queue_limit) {
+            queued.fetch_sub(1, std::memory_order_relaxed);
+        }
+        bool bulk = pri == static_cast<int>(Priority::Bulk);
+        if (bulk) {
+            bulk_running.fetch_add(1, std::memory_order_relaxed);
+        }
+        tls_pri = static_cast<Priority>(pri);
+        t->fn();
+        task_node_cache::release(t);
+        if (bulk) {
+            bulk_running.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    void run_worker(int id) {
+        worker* w = m_Workers[id].get();
+        tls_pool = this;
+        tls_worker = w;
+        bool woken = false; // 被notify_idle()叫醒的, 负责清掉waking
+        int pri = 0;
+        while (pool_status <= 1) {
+            task* t = find_task(w, id, pri);
+            if (woken) {
+                woken = false;
+                waking.store(false);
+                if (t && has_pending(w)) {
+                    notify_idle();
+                }
+            }
+            if (t) {
+                run_task(t, pri);
+                continue;
+            }
+            if (pool_status == 1) {
+                break; // 到处都空了
+            }
+            uint64_t seq;
+            {
+                std::lock_guard<std::mutex> lock(park_mutex);
+                seq = wake_seq;
+                idle.fetch_add(1, std::memory_order_seq_cst);
+            }
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            // 登记之后再扫一遍, 登记前入队的任务在这里能看到
+            if (task* t = find_task(w, id, pri)) {
+                idle.fetch_sub(1, std::memory_order_relaxed);
+                run_task(t, pri);
+                continue;
+            }
+            {
+                std::unique_lock<std::mutex> lock(park_mutex);
+                m_Condition.wait(lock, [&] {
+                    return wake_seq != seq || pool_status != 0;
+                });
+            }
+            idle.fetch_sub(1, std::memory_order_relaxed);
+            woken = true;
+        }
+        tls_pool = nullptr;
+        tls_worker = nullptr;
+    }
 };
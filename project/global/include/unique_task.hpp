@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/*
+    只能移动的void()可调用对象, 给线程池当任务用
+    - 不超过INLINE_SIZE字节且能noexcept移动的可调用对象直接放在对象内部, 不分配内存
+    - 放不下的才new到堆上, 内部只存一个指针
+    - 和std::function相比不要求可拷贝, 所以packaged_task、unique_ptr之类可以直接放进来
+*/
+class unique_task {
+public:
+    static constexpr size_t INLINE_SIZE = 48;
+
+    unique_task() noexcept = default;
+
+    template<typename F,
+             typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, unique_task>>>
+    unique_task(F&& f) {
+        using T = std::decay_t<F>;
+        if constexpr (fits_inline<T>()) {
+            ::new (static_cast<void*>(buf)) T(std::forward<F>(f));
+            vt = &inline_ops<T>;
+        } else {
+            *reinterpret_cast<T**>(buf) = new T(std::forward<F>(f));
+            vt = &heap_ops<T>;
+        }
+    }
+
+    unique_task(unique_task&& other) noexcept : vt(other.vt) {
+        if (vt) {
+            vt->move(buf, other.buf);
+            other.vt = nullptr;
+        }
+    }
+
+    unique_task& operator=(unique_task&& other) noexcept {
+        if (this != &other) {
+            reset();
+            vt = other.vt;
+            if (vt) {
+                vt->move(buf, other.buf);
+                other.vt = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    unique_task(const unique_task&) = delete;
+    unique_task& operator=(const unique_task&) = delete;
+
+    ~unique_task() { reset(); }
+
+    explicit operator bool() const noexcept { return vt != nullptr; }
+
+    void operator()() { vt->call(buf); }
+
+    void reset() noexcept {
+        if (vt) {
+            vt->destroy(buf);
+            vt = nullptr;
+        }
+    }
+
+private:
+    struct ops {
+        void (*call)(void* self);
+        void (*move)(void* dst, void* src) noexcept; // 移到dst, 并析构src
+        void (*destroy)(void* self) noexcept;
+    };
+
+    template<typename T>
+    static constexpr bool fits_inline() {
+        return sizeof(T) <= INLINE_SIZE
+            && alignof(std::max_align_t) % alignof(T) == 0
+            && std::is_nothrow_move_constructible_v<T>;
+    }
+
+    template<typename T>
+    static inline const ops inline_ops = {
+        [](void* self) { (*static_cast<T*>(self))(); },
+        [](void* dst, void* src) noexcept {
+            ::new (dst) T(std::move(*static_cast<T*>(src)));
+            static_cast<T*>(src)->~T();
+        },
+        [](void* self) noexcept { static_cast<T*>(self)->~T(); }
+    };
+
+    template<typename T>
+    static inline const ops heap_ops = {
+        [](void* self) { (**static_cast<T**>(self))(); },
+        [](void* dst, void* src) noexcept { *static_cast<T**>(dst) = *static_cast<T**>(src); },
+        [](void* self) noexcept { delete *static_cast<T**>(self); }
+    };
+
+    alignas(std::max_align_t) unsigned char buf[INLINE_SIZE];
+    const ops* vt = nullptr;
+};
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/*
+    Chase-Lev工作窃取双端队列(Lê等人给出的C11内存序版本)
+    - 只有拥有者线程能push()/pop(), 在底部进出(后进先出, 刚放进去的任务还在缓存里)
+    - 其他线程用steal()从顶部偷(先进先出), 与拥有者之间只在最后一个元素上CAS竞争
+    - 元素必须是指针这类可以原子读写的小类型, 空值(T{})表示"没取到"
+    - 满了就扩容成两倍, 旧数组留到析构再释放, 因为窃取者可能还在读
+*/
+template<typename T>
+class ws_deque {
+public:
+    explicit ws_deque(int64_t capacity = 256) {
+        int64_t cap = 1;
+        while (cap < capacity) cap <<= 1;
+        arrays.emplace_back(new array(cap));
+        arr.store(arrays.back().get(), std::memory_order_relaxed);
+    }
+    ws_deque(const ws_deque&) = delete;
+    ws_deque& operator=(const ws_deque&) = delete;
+
+    // 仅拥有者调用
+    void push(T x) {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        array* a = arr.load(std::memory_order_relaxed);
+        if (b - t > a->cap - 1) {
+            a = grow(a, b, t);
+        }
+        a->put(b, x);
+        bottom.store(b + 1, std::memory_order_release); // 发布元素给窃取者
+    }
+
+    // 仅拥有者调用, 空了返回T{}
+    T pop() {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        array* a = arr.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+        T x{};
+        if (t <= b) {
+            x = a->get(b);
+            if (t == b) {
+                // 只剩一个, 和窃取者抢
+                if (!top.compare_exchange_strong(t, t + 1,
+                        std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                    x = T{};
+                }
+                bottom.store(b + 1, std::memory_order_relaxed);
+            }
+        } else {
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return x;
+    }
+
+    // 任意线程调用, 空了或者抢输了返回T{}
+    T steal() {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b) {
+            return T{};
+        }
+        array* a = arr.load(std::memory_order_acquire);
+        T x = a->get(t);
+        if (!top.compare_exchange_strong(t, t + 1,
+                std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return T{};
+        }
+        return x;
+    }
+
+    // 近似值, 只用来判断要不要去偷
+    bool empty() const {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_relaxed);
+        return b <= t;
+    }
+
+private:
+    struct array {
+        int64_t cap;
+        std::unique_ptr<std::atomic<T>[]> buf;
+
+        explicit array(int64_t cap) : cap(cap), buf(new std::atomic<T>[cap]) {}
+        T get(int64_t i) const { return buf[i & (cap - 1)].load(std::memory_order_relaxed); }
+        void put(int64_t i, T x) { buf[i & (cap - 1)].store(x, std::memory_order_relaxed); }
+    };
+
+    array* grow(array* a, int64_t b, int64_t t) {
+        auto na = new array(a->cap * 2);
+        for (int64_t i = t; i < b; ++i) {
+            na->put(i, a->get(i));
+        }
+        arrays.emplace_back(na);
+        arr.store(na, std::memory_order_release);
+        return na;
+    }
+
+    alignas(64) std::atomic<int64_t> top{0};
+    alignas(64) std::atomic<int64_t> bottom{0};
+    std::atomic<array*> arr{nullptr};
+    std::vector<std::unique_ptr<array>> arrays; // 只有拥有者会追加
+};
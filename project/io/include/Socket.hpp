@@ -5,6 +5,7 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <cstdlib>
 #include <fcntl.h>
@@ -14,6 +15,7 @@
 #include <mutex>
 #include "../../global/include/file.hpp"
 #include "../include/ioaction.hpp"
+#include "../include/ring_buffer.hpp"
 #include "../../global/include/command.hpp"
 
 class Socket;
@@ -54,10 +56,11 @@ protected:
     std::mutex write_mutex;
 
     // 分包状态
-    enum RecvPhase { READING_SIZE, READING_PAYLOAD };
-    RecvPhase recv_phase = READING_SIZE;
-    size_t expected_size = 0;
-    std::string packet_buf; // 用于拼接半包/粘包
+    ring_buffer recv_buf;        // 接收环形缓冲区, 处理半包/粘包
+    size_t pending_consume = 0;  // 上次交出的帧长度, 下次收包时再释放
+
+    // 调用方已持有write_mutex
+    ssize_t send_frames_locked(const std::string_view* frames, size_t count);
 
 public:
     explicit DataSocket(int fd, bool nonblock = false) : Socket(fd, nonblock) {}
@@ -70,7 +73,11 @@ public:
     ssize_t receive(size_t size = -1);
     ssize_t send(size_t size = -1);
     ssize_t send_with_size();
+    // 多帧一次写出(长度头+载荷合并成一次sendmsg), 写完为止
+    // 返回写出的总字节数, 出错返回-1
+    ssize_t send_frames(const std::string_view* frames, size_t count);
     bool send_protocol(const std::string& proto);
+    bool send_protocols(const std::vector<std::string>& protos);
     bool receive_protocol(std::string& proto);
 
     // 事件内循环读, 自动处理粘包/半包
@@ -81,6 +88,8 @@ public:
         Error
     };
     RecvState receive_protocol_with_state(std::string& proto);
+    // 同上, 但不拷贝: frame指向接收缓冲区, 下次调用前有效
+    RecvState receive_frame(std::string_view& frame);
 };
 
 class AcceptedSocket : public DataSocket {
@@ -117,6 +126,7 @@ public:
 class ListenSocket : public Socket {
 private:
     bool binded = false;
+    bool reuse_port = false;
     std::string ip;
     uint16_t port = 0;
 
@@ -124,10 +134,15 @@ public:
     ListenSocket(bool nonblock = false);
     ListenSocket(const std::string& ip, uint16_t port, bool nonblock = false);
 
+    // 多个监听套接字绑定同一端口, 由内核分发连接, 需在bind()前设置
+    void set_reuse_port(bool reuse = true);
     bool bind();
     bool listen();
     bool isBinded() const;
     AcceptedSocket* accept();
+    // accept4(SOCK_NONBLOCK | SOCK_CLOEXEC)一次, 不抛异常
+    // 没有待接受的连接(EAGAIN)或出错时返回nullptr, 原因看errno
+    AcceptedSocket* try_accept();
 };
 
 using ASocket = AcceptedSocket;
@@ -2,8 +2,30 @@
 
 #include <unistd.h>
 #include <string>
+#include <string_view>
 
 ssize_t read_size_from(int fd, size_t* datasize);
 ssize_t write_size_to(int fd, size_t* const datasize);
 ssize_t read_from(int fd, std::string& buf, size_t size = -1);
 ssize_t write_to(int fd, const std::string& buf, size_t size = -1);
+
+// 单帧(长度头之后)的上限: 最大的合法帧是4MB文件分片加各层帧头, 取发送队列的上限16MB
+// 收到超过它的长度头按出错处理, 不按对端声称的长度分配内存
+constexpr size_t MAX_FRAME_SIZE = 16 * 1024 * 1024;
+
+// 一次sendmsg写出多帧(每帧 4字节长度 + 载荷), 带MSG_NOSIGNAL
+// skip: 这批帧里之前已写出的字节数, 部分写后从断点续写
+// 单次最多处理 MAX_FRAMES_PER_WRITE 帧, 其余留给下一次调用
+// 返回本次写出的字节数; 不可写返回0(EAGAIN), 出错返回-1
+constexpr size_t MAX_FRAMES_PER_WRITE = 64;
+ssize_t write_frames_to(int fd, const std::string_view* frames, size_t count, size_t skip = 0);
+// 同上, 但每帧的载荷是heads[i]和bodies[i]拼起来的(body可以是多个连接共用的缓冲区);
+// heads为空时等同write_frames_to
+ssize_t write_frames_to(int fd, const std::string_view* heads, const std::string_view* bodies,
+                        size_t count, size_t skip = 0);
+// 一批帧在线路上的总字节数(含长度头)
+size_t frames_wire_size(const std::string_view* frames, size_t count);
+// 一帧 = 4字节长度 + head + 文件[offset, offset+file_len)
+// head用sendmsg写, 文件部分用sendfile从页缓存直接进socket, 不经过用户态
+// skip/返回值同write_frames_to; 对端关闭时sendfile会发SIGPIPE, 进程需忽略该信号
+ssize_t write_file_frame_to(int fd, std::string_view head, int file_fd, off_t offset, size_t file_len, size_t skip = 0);
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+    单连接复用模式下的帧格式(仍在4字节长度头之内):
+        [1字节头: 低2位通道号, 最高位表示后面还有分片] [分片数据]
+    通道号与三个逻辑服务器一致: 0 消息, 1 命令, 2 数据
+    大包按FRAGMENT_SIZE切片, 各通道在发送队列里轮流出帧,
+    文件分片就不会把聊天和命令堵在后面
+*/
+namespace mux {
+    constexpr int CHANNEL_NUM = 3;
+    constexpr uint8_t CHANNEL_MASK = 0x03;
+    constexpr uint8_t MORE = 0x80;
+    constexpr size_t FRAGMENT_SIZE = 64 * 1024;
+
+    // 一个分片的帧头
+    inline char header(int channel, bool more) {
+        return static_cast<char>((static_cast<uint8_t>(channel) & CHANNEL_MASK) | (more ? MORE : 0));
+    }
+
+    // 把一个完整的包切成若干mux帧
+    std::vector<std::string> split(int channel, std::string_view payload, size_t fragment = FRAGMENT_SIZE);
+
+    // 按通道重组分片, 一个连接一个, 只能单线程使用
+    class reassembler {
+    private:
+        std::string partial[CHANNEL_NUM];
+        bool consumed[CHANNEL_NUM] = {false, false, false};
+
+    public:
+        // 喂一帧; 凑齐一个完整的包时返回true, channel/packet给出结果
+        // packet在同一通道下一次feed前有效, 不分片的包直接指向frame, 不拷贝
+        // 帧头非法或者重组的包超过MAX_FRAME_SIZE时返回false并把channel置为-1, 调用方应断开连接
+        bool feed(std::string_view frame, int& channel, std::string_view& packet);
+    };
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <memory>
+#include <string_view>
+#include <sys/types.h>
+
+/*
+    每个连接一个的发送队列(有界)
+    - 发送方push()后立即返回, 由flush()在可写时一次sendmsg批量写出
+    - 部分写记录在front_offset里, 下次从断点续写, 帧不会交错
+    - 同一时刻只有一个线程在flush, 其他线程的flush()直接返回,
+      新入队的帧由正在flush的线程顺带写出
+    - 可分多条通道(lane), flush时各通道轮流出帧;
+      一帧写了一半时必须先把它写完, 再轮到别的通道
+    - 水位(按所有通道合计):
+        超过高水位 -> above_high(), 调用方暂停读/生产者等待
+        回到低水位 -> wait_below_low() 的等待者被唤醒
+        超过硬上限 -> push()拒收, 调用方应断开这个慢消费者
+    - push_file()入队的帧只有头部在内存里, 数据留在文件中, flush时sendfile写出
+    - push_shared()入队的帧 = 自己的head + 共用缓冲区的一段, 群发时各连接只持有引用
+    - push_many()把一个包切成的几帧(复用模式的分片)在一把锁内整体入队, 要么全进要么都不进;
+      几个线程同时往一个通道发大包时, 分片不会交错
+*/
+
+// 只读打开的文件, 多个文件帧共用, 最后一个持有者释放时关闭
+class shared_file {
+public:
+    static std::shared_ptr<shared_file> open(const std::string& path);
+    ~shared_file();
+    shared_file(const shared_file&) = delete;
+    shared_file& operator=(const shared_file&) = delete;
+
+    int get_fd() const { return fd; }
+
+private:
+    explicit shared_file(int fd) : fd(fd) {}
+    int fd;
+};
+
+class outbound_queue {
+public:
+    struct limits {
+        size_t high_bytes  = 4 * 1024 * 1024;
+        size_t low_bytes   = 1 * 1024 * 1024;
+        size_t high_frames = 4096;
+        size_t low_frames  = 1024;
+        size_t max_bytes   = 16 * 1024 * 1024;
+        size_t max_frames  = 16384;
+    };
+
+    enum class PushResult {
+        Queued,     // 入队, 水位正常
+        AboveHigh,  // 入队, 但已超过高水位
+        Overflow,   // 超过硬上限, 没有入队
+        Closed      // 队列已关闭, 没有入队
+    };
+
+    enum class FlushResult {
+        Drained,    // 队列写空了
+        Blocked,    // 内核发送缓冲区满, 需要等EPOLLOUT
+        Busy,       // 别的线程正在flush
+        Error       // 写出错(对端关闭等)
+    };
+
+    static constexpr int MAX_LANES = 4;
+
+private:
+    struct entry {
+        std::string frame;  // 内存部分, 文件帧/共用帧时是帧的前半段
+        std::shared_ptr<shared_file> file;
+        off_t offset = 0;
+        size_t file_len = 0;
+        std::shared_ptr<const std::string> body; // 共用的后半段
+        std::string_view body_view;
+
+        size_t wire_size() const;
+
+        static entry memory(std::string frame);
+        static entry from_file(std::string head, std::shared_ptr<shared_file> file, off_t offset, size_t len);
+        static entry shared(std::string head, std::shared_ptr<const std::string> body, size_t offset, size_t len);
+    };
+
+public:
+    // 要一起入队的几帧, 各帧的形式同push()/push_file()/push_shared()
+    class batch {
+    public:
+        void add(std::string frame);
+        void add_file(std::string head, std::shared_ptr<shared_file> file, off_t offset, size_t len);
+        void add_shared(std::string head, std::shared_ptr<const std::string> body, size_t offset, size_t len);
+        bool empty() const { return entries.empty(); }
+
+    private:
+        friend class outbound_queue;
+        std::vector<entry> entries;
+    };
+
+    outbound_queue() = default;
+    explicit outbound_queue(const limits& lim) : lim(lim) {}
+    outbound_queue(const outbound_queue&) = delete;
+    outbound_queue& operator=(const outbound_queue&) = delete;
+
+    PushResult push(std::string frame, int lane = 0);
+    // 帧 = head + 文件[offset, offset+len), 长度头按两者之和写
+    PushResult push_file(std::string head, std::shared_ptr<shared_file> file,
+                         off_t offset, size_t len, int lane = 0);
+    // 帧 = head + (*body)[offset, offset+len), body在写出前不能被修改
+    PushResult push_shared(std::string head, std::shared_ptr<const std::string> body,
+                           size_t offset, size_t len, int lane = 0);
+    PushResult push_many(batch frames, int lane = 0);
+    FlushResult flush(int fd);
+    // 关闭后push()一律拒收, 等待者全部放行
+    void close();
+
+    size_t bytes();
+    size_t frames();
+    bool above_high();
+    bool below_low();
+    // 阻塞直到回到低水位或队列关闭, 超时返回false
+    bool wait_below_low(std::chrono::milliseconds timeout);
+
+private:
+    limits lim;
+    std::mutex m_Mutex;
+    std::condition_variable m_Condition;
+    std::deque<entry> lanes[MAX_LANES]; // deque尾插不会移动已有元素, flush时可以不持锁写
+    size_t queued_bytes = 0;         // 未写出的字节数(含长度头)
+    size_t queued_frames = 0;
+    int partial_lane = -1;           // 写了一半的帧所在通道(就是该通道的队首)
+    size_t front_offset = 0;         // 这一帧已写出的字节数
+    int rr_next = 0;                 // 轮转起点
+    bool flushing = false;
+    bool closed = false;
+
+    bool above_high_locked() const;
+    bool below_low_locked() const;
+    PushResult push_entry(entry e, int lane);
+};
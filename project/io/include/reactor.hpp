@@ -5,25 +5,60 @@
 #include <unistd.h>
 #include <cerrno>
 #include <string>
-#include <unordered_map>
 #include <functional>
 #include <any>
 #include <memory>
 #include <stdexcept>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "timing_wheel.hpp"
 
 class TcpServerConnection;
 class reactor;
+class event;
 
+// 每个fd一个槽位, epoll_event.data.ptr直接指向它, 事件循环里不用查表
+struct event_slot {
+    int fd = -1;
+    event* read = nullptr;
+    event* write = nullptr;
+};
+
+/*
+    事件对象, 一个fd最多一读一写两个
+    - 事件里带EPOLLONESHOT时为一次性布防: 触发后内核自动解除,
+      处理完再add_to_reactor()重新布防, 只需一次EPOLL_CTL_MOD
+    - 同一fd的读写事件共用一份epoll登记, 记在owner(先登记的那个)身上,
+      布防状态都在事件对象里, 不用再查reactor的表
+    - epoll状态只在reactor线程里改: 其他线程调add_to_reactor()/remove_from_reactor()
+      会被post到reactor线程执行, 所以布防状态不用加锁
+*/
 class event {
 private:
     int fd;
-    bool in_reactor;
-    bool binded;
-    uint32_t events;
+    bool binded = false;
+    bool oneshot = false;
+    uint32_t events; // 关注的事件位和触发方式(EPOLLET), 不含EPOLLONESHOT
+
+    event_slot* slot = nullptr; // bind_with时取得, 析构时清掉自己
+    // 同fd的另一个事件; owner是持有epoll登记的那个(没配对时是自己)
+    event* owner = this;
+    event* peer = nullptr;
+    // 以下只在owner上使用, 只在reactor线程读写
+    uint32_t armed = 0;       // 当前在epoll里布防的事件位
+    bool registered = false;  // fd是否已经EPOLL_CTL_ADD
+
+    uint32_t interest() const;
+    bool oneshot_mode() const;
+    int ctl(int op, uint32_t mask);
 
 public:
-    TcpServerConnection* conn;
-    reactor* pr;
+    TcpServerConnection* conn = nullptr;
+    reactor* pr = nullptr;
     std::function<void()> call_back_func;
 
     event(int fd, uint32_t ev, TcpServerConnection* conn, std::function<void()> cb);
@@ -40,30 +75,66 @@ public:
     void set(std::function<void()> cb);
     void set(uint32_t ev, std::function<void()> cb);
     void bind_with(reactor* re);
+    // 同一fd的读写事件配对, 共用一份登记, this作为owner
+    void pair_with(event* other);
+    // 布防; 一次性事件重新布防也用它. 任意线程可调用
     void add_to_reactor();
+    // 撤防; 一次性事件已触发过时不需要系统调用. 任意线程可调用
     void remove_from_reactor();
-    // void modify_in_reactor();
-    // void add_or_modify_in_reactor();
+    // 以下两个直接改epoll, 只能在reactor线程调用
     void add_event_to_fd();
     void remove_event_from_fd();
+    // reactor线程在事件就绪后调用(对owner), 返回本次该分发的事件位
+    // 一次性模式下内核已整体撤防, 没触发的那一半在这里补布防
+    uint32_t on_fire(uint32_t revents);
     void call_back();
     bool is_binded() const;
+    bool is_oneshot() const;
     bool in_epoll() const;
     int get_sockfd() const;
     void set_sockfd(int new_fd);
 };
 
+// epoll系统调用计数, 压测用
+struct reactor_stats {
+    uint64_t ctl_calls = 0;    // epoll_ctl次数
+    uint64_t wait_calls = 0;   // epoll_wait次数
+    uint64_t ready_events = 0; // epoll_wait返回的就绪事件总数
+    uint64_t wakeups = 0;      // 跨线程post写eventfd的次数
+};
+
 class reactor {
 private:
     int epoll_fd = -1;
     int max_events = 2048;
     int epoll_timeout = 1000;
 
+    // fd -> 槽位, 按块分配, 块一旦分配就不再移动, 槽位指针可以交给epoll
+    // 读不加锁, 只有分配新块时加锁
+    static constexpr int SLOT_CHUNK_BITS = 12;  // 每块4096个槽位
+    static constexpr int SLOT_CHUNK_NUM = 1024; // 最多支持约4M个fd
+    std::unique_ptr<std::atomic<event_slot*>[]> slot_chunks;
+    std::mutex slot_mutex;
+
+    timing_wheel timers; // 定时器, epoll_wait的超时按下一个刻度算
+
+    // 跨线程投递: 任务进队列, 队列从空变非空时写一次eventfd唤醒epoll_wait
+    int wake_fd = -1;
+    event_slot wake_slot;
+    std::mutex task_mutex;
+    std::vector<std::function<void()>> tasks;
+    std::atomic<std::thread::id> loop_tid;
+
+    std::atomic<uint64_t> ctl_calls = 0;
+    std::atomic<uint64_t> wait_calls = 0;
+    std::atomic<uint64_t> ready_events = 0;
+    std::atomic<uint64_t> wakeups = 0;
+
+    void init_wakeup();
+    void drain_wakeup();
+
 public:
     friend class event;
-    //std::unordered_map<int, event*> events;
-    std::unordered_map<int, uint32_t> fd_events_map;
-    std::unordered_map<int, std::pair<event*, event*>> fd_event_obj;
     epoll_event* epoll_events = nullptr;
 
     reactor();
@@ -74,10 +145,27 @@ public:
     reactor& operator=(reactor&&) = delete;
     ~reactor();
 
+    // 登记读/写事件, 同一fd的读写事件会自动配对
     void add_revent(event* ev, int fd);
     void add_wevent(event* ev, int fd);
+    // 取fd对应的槽位, 没有就分配
+    event_slot* slot_of(int fd);
     int wait();
     int get_epoll_fd() const;
+    // 定时器: 回调在reactor线程执行, 任意线程可加/取消
+    timing_wheel::timer_id run_after(std::chrono::milliseconds delay, std::function<void()> cb);
+    bool cancel_timer(timing_wheel::timer_id id);
+    // 投递到reactor线程执行, 任意线程可调用
+    void post(std::function<void()> cb);
+    // 在reactor线程里直接执行, 否则post
+    void run_in_loop(std::function<void()> cb);
+    bool in_loop_thread() const;
+    // 唤醒阻塞中的epoll_wait(比如停止时)
+    void wakeup();
+    // 事件处理完后由事件循环调用: 执行投递来的任务和到期的定时器
+    void run_pending();
+    reactor_stats stats() const;
+    void reset_stats();
 };
 
 using rea = reactor;
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <sys/types.h>
+
+/*
+    每个连接一个的接收缓冲区(环形, 容量为2的幂, 可扩容)
+    - read_fd() 用readv直接读进空闲区, 空闲区跨环尾时分两段
+    - contiguous() 以string_view交出数据, 不拷贝;
+      只有数据正好跨过环尾时才整理一次(把数据搬到开头)
+    - 单帧超过容量时按2的幂扩容, 读空后大缓冲区还回去
+    交出的view在下一次consume()/read_fd()前有效
+*/
+class ring_buffer {
+private:
+    std::unique_ptr<char[]> buf;
+    size_t cap = 0;
+    size_t init_cap = 0;
+    size_t head = 0; // 读位置, 单调递增, 用时取模
+    size_t tail = 0; // 写位置, 同上
+
+    size_t mask() const { return cap - 1; }
+    // 数据搬到从0开始的位置, new_cap不小于当前容量
+    void linearize(size_t new_cap);
+
+public:
+    explicit ring_buffer(size_t capacity = 16 * 1024);
+    ring_buffer(const ring_buffer&) = delete;
+    ring_buffer& operator=(const ring_buffer&) = delete;
+
+    size_t readable() const { return tail - head; }
+    size_t writable() const { return cap - readable(); }
+    size_t capacity() const { return cap; }
+
+    // 一次readv读满空闲区, 返回值同readv
+    ssize_t read_fd(int fd);
+    // 从读位置偏移offset处拷出len字节(用于读跨环尾的包头)
+    void peek(void* dst, size_t len, size_t offset = 0) const;
+    // 保证[offset, offset + len)连续并返回其视图
+    std::string_view contiguous(size_t offset, size_t len);
+    void consume(size_t len);
+    // 保证容量至少为len
+    void reserve(size_t len);
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+/*
+    哈希时间轮(带圈数), 给reactor做定时器
+    - 槽位数 x 刻度 为一圈, 超过一圈的定时器记圈数, 每转过一次减一
+    - 增删都是O(1), 推进时只看当前槽位
+    - 由reactor线程在epoll_wait返回后调用advance()推进, 回调在reactor线程执行
+    - 回调在锁内执行(递归锁), 回调里可以再加/删定时器;
+      cancel()返回时保证对应回调不在执行中, 析构方可以放心释放回调用到的对象
+*/
+class timing_wheel {
+public:
+    using timer_id = uint64_t;
+    using clock = std::chrono::steady_clock;
+
+    explicit timing_wheel(size_t slot_num = 1024,
+                          std::chrono::milliseconds tick = std::chrono::milliseconds(100));
+    timing_wheel(const timing_wheel&) = delete;
+    timing_wheel& operator=(const timing_wheel&) = delete;
+
+    // delay后执行一次cb, 精度为一个刻度; 返回的id不会为0
+    timer_id add(std::chrono::milliseconds delay, std::function<void()> cb);
+    // 已触发或不存在返回false
+    bool cancel(timer_id id);
+    // 推进到now, 执行所有到期回调
+    void advance(clock::time_point now = clock::now());
+    // 距下一个刻度的毫秒数, 没有定时器时返回-1
+    int next_timeout_ms(clock::time_point now = clock::now());
+    size_t size();
+
+private:
+    struct node {
+        timer_id id;
+        size_t rounds;
+        std::function<void()> cb;
+    };
+    static constexpr size_t FIRING = static_cast<size_t>(-1); // 已到期, 等待执行
+
+    std::vector<std::list<node>> slots;
+    std::list<node> firing; // 本轮到期的定时器
+    std::unordered_map<timer_id, std::pair<size_t, std::list<node>::iterator>> index;
+    std::chrono::milliseconds tick;
+    clock::time_point last_tick;
+    size_t cursor = 0;
+    timer_id next_id = 1;
+    std::recursive_mutex m_Mutex;
+};
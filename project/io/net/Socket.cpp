@@ -4,6 +4,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <cstring>
+#include <algorithm>
 
 /* ----- Socket ----- */
 
@@ -115,17 +116,42 @@ ssize_t DataSocket::send_with_size() {
     if (fd < 0) {
         return -1;
     }
-    size_t size = write_buf.size();
-    if (size == 0) {
+    std::lock_guard<std::mutex> lock(write_mutex);
+    if (write_buf.empty()) {
         return 0; // No data to send
     }
-    ::write_size_to(fd, &size);
-    // debug
-    // std::cout << "Debug发送大小: " << std::dec << size << std::endl;
-    // for (unsigned char c : write_buf) {
-    //     std::cout << std::hex << (int)c << " ";
-    // } std::cout << std::endl;
-    return size + send(size);
+    std::string_view frame(write_buf);
+    return send_frames_locked(&frame, 1);
+}
+
+ssize_t DataSocket::send_frames(const std::string_view* frames, size_t count) {
+    if (fd < 0) {
+        return -1;
+    }
+    std::lock_guard<std::mutex> lock(write_mutex);
+    return send_frames_locked(frames, count);
+}
+
+ssize_t DataSocket::send_frames_locked(const std::string_view* frames, size_t count) {
+    // 每轮最多MAX_FRAMES_PER_WRITE帧, 部分写时带着偏移续写
+    size_t total = 0;
+    while (count > 0) {
+        size_t batch = std::min(count, MAX_FRAMES_PER_WRITE);
+        size_t batch_size = ::frames_wire_size(frames, batch);
+        size_t sent = 0;
+        while (sent < batch_size) {
+            ssize_t n = ::write_frames_to(fd, frames, batch, sent);
+            if (n < 0) {
+                return -1;
+            }
+            // n == 0: 发送缓冲区满, 和write_to一样原地重试
+            sent += static_cast<size_t>(n);
+        }
+        total += batch_size;
+        frames += batch;
+        count -= batch;
+    }
+    return static_cast<ssize_t>(total);
 }
 
 bool DataSocket::send_protocol(const std::string& proto) {
@@ -139,71 +165,95 @@ bool DataSocket::send_protocol(const std::string& proto) {
     return true;
 }
 
+bool DataSocket::send_protocols(const std::vector<std::string>& protos) {
+    if (protos.empty()) {
+        return true;
+    }
+    std::vector<std::string_view> frames(protos.begin(), protos.end());
+    ssize_t res = send_frames(frames.data(), frames.size());
+    if (res <= 0) {
+        log_error("Failed to send {} protocols: {}", protos.size(), strerror(errno));
+        return false;
+    }
+    return true;
+}
+
 bool DataSocket::receive_protocol(std::string& proto) {
     if (fd < 0) {
         return false; // Invalid socket
     }
-    size_t size = 0;
-    ssize_t received = ::read_size_from(fd, &size);
-    if (received <= 0) {
-        log_error("Failed to read size from socket: {}", strerror(errno));
+    // 阻塞套接字上readv会一直等到有数据, 和非阻塞读共用同一个接收缓冲区
+    std::string_view frame;
+    while (true) {
+        RecvState state = receive_frame(frame);
+        if (state == RecvState::Success) {
+            proto.assign(frame.data(), frame.size());
+            return true;
+        }
+        if (state == RecvState::NoMoreData) {
+            return false;
+        }
+        log_error("Failed to receive protocol: {}", strerror(errno));
         return false;
     }
-    std::string tmp;
-    ssize_t total = 0;
-    while (total < size) {
-        char buf[4096];
-        ssize_t n = ::read(fd, buf, std::min(sizeof(buf), size - total));
-        if (n <= 0) return false;
-        tmp.append(buf, n);
-        total += n;
-    }
-    proto = tmp;
-    // debug
-    // std::cout << "Debug收到大小: " << std::dec << proto.size() << std::endl;
-    // for (unsigned char c : proto) {
-    //     std::cout << std::hex << (int)c << " ";
-    // } std::cout << std::endl;
-    return true;
 }
 
 DataSocket::RecvState DataSocket::receive_protocol_with_state(std::string& proto) {
+    std::string_view frame;
+    RecvState state = receive_frame(frame);
+    if (state == RecvState::Success) {
+        proto.assign(frame.data(), frame.size());
+    }
+    return state;
+}
+
+DataSocket::RecvState DataSocket::receive_frame(std::string_view& frame) {
     if (fd < 0) return RecvState::Error; // Invalid socket
 
-    // 1. 事件内循环读到EAGAIN, 拼接到packet_buf
-    char tmp[4096];
-    bool has_new_data = false;
+    // 释放上次交出的帧
+    if (pending_consume > 0) {
+        recv_buf.consume(pending_consume);
+        pending_consume = 0;
+    }
+
     while (true) {
-        ssize_t n = ::read(fd, tmp, sizeof(tmp));
+        // 1. 缓冲区里已有完整的包就直接拆, 不用系统调用
+        if (recv_buf.readable() >= 4) {
+            uint32_t net_len;
+            recv_buf.peek(&net_len, 4);
+            size_t expected_size = ntohl(net_len);
+            if (expected_size > MAX_FRAME_SIZE) {
+                log_error("Frame of {} bytes exceeds limit (fd:{})", expected_size, fd);
+                return RecvState::Error;
+            }
+            if (recv_buf.readable() >= 4 + expected_size) {
+                frame = recv_buf.contiguous(4, expected_size);
+                pending_consume = 4 + expected_size;
+                return RecvState::Success;
+            }
+            // 包体不够且缓冲区满了才扩容, 每次翻倍, 随数据真正到达长大
+            if (recv_buf.writable() == 0) {
+                recv_buf.reserve(std::min(recv_buf.capacity() * 2, 4 + expected_size));
+            }
+        }
+
+        // 2. 直接读进缓冲区空闲处, 直到EAGAIN
+        ssize_t n = recv_buf.read_fd(fd);
         if (n > 0) {
-            packet_buf.append(tmp, n);
-            has_new_data = true;
+            continue;
         } else if (n == 0) {
             // 对端关闭
             return RecvState::Disconnected;
+        } else if (errno == EINTR) {
+            continue;
         } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
-            break;
+            // 暂时没有完整包
+            return RecvState::NoMoreData;
         } else {
             // 错误
             return RecvState::Error;
         }
     }
-
-    // 2. 拆包
-    if (packet_buf.size() < 4) {
-        // 如果没有读到新数据且缓冲区不足4字节, 说明暂时没有完整包
-        return RecvState::NoMoreData;
-    }
-    uint32_t net_len;
-    memcpy(&net_len, packet_buf.data(), 4);
-    size_t expected_size = ntohl(net_len);
-    if (packet_buf.size() < 4 + expected_size) {
-        // 包体不够, 需要等待更多数据
-        return RecvState::NoMoreData;
-    }
-    proto = packet_buf.substr(4, expected_size);
-    packet_buf.erase(0, 4 + expected_size);
-    return RecvState::Success;
 }
 
 /* ----- AcceptedSocket ----- */
@@ -331,6 +381,10 @@ LSocket::ListenSocket(const std::string& ip, uint16_t port, bool nonblock)
     }
 }
 
+void LSocket::set_reuse_port(bool reuse) {
+    reuse_port = reuse;
+}
+
 bool LSocket::bind() {
     addr.sin_family = AF_INET;
     addr.sin_port = htons(port);
@@ -344,6 +398,10 @@ bool LSocket::bind() {
         log_error("设置端口复用{}:{}失败: {}", ip, port, strerror(errno));
         return false;
     }
+    if (reuse_port && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        log_error("设置SO_REUSEPORT {}:{}失败: {}", ip, port, strerror(errno));
+        return false;
+    }
     if (::bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
         log_error("Listen socket 绑定{}:{}失败: {}", ip, port, strerror(errno));
         return false;
@@ -366,6 +424,22 @@ bool LSocket::listen() {
     return true;
 }
 
+ASocket* LSocket::try_accept() {
+    if (!binded) {
+        errno = EINVAL;
+        return nullptr;
+    }
+    int client_fd;
+    do {
+        client_fd = ::accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    } while (client_fd < 0 && errno == EINTR);
+    if (client_fd < 0) {
+        return nullptr;
+    }
+    // 已经是非阻塞的, 不用再fcntl
+    return new ASocket(client_fd, false);
+}
+
 ASocket* LSocket::accept() {
     if (!binded) {
         throw std::runtime_error("Socket is not binded");
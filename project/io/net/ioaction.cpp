@@ -3,6 +3,9 @@
 #include <cstdio>
 #include <cstdint>
 #include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
 
 ssize_t read_size_from(int fd, size_t* datasize) {
     if (fd < 0 || !datasize) {
@@ -94,3 +97,121 @@ ssize_t write_to(int fd, const std::string& buf, size_t size) {
     }
     return total_written;
 }
+
+size_t frames_wire_size(const std::string_view* frames, size_t count) {
+    size_t total = 0;
+    for (size_t i = 0; i < count; ++i) {
+        total += sizeof(uint32_t) + frames[i].size();
+    }
+    return total;
+}
+
+ssize_t write_frames_to(int fd, const std::string_view* frames, size_t count, size_t skip) {
+    return write_frames_to(fd, nullptr, frames, count, skip);
+}
+
+ssize_t write_frames_to(int fd, const std::string_view* heads, const std::string_view* bodies,
+                        size_t count, size_t skip) {
+    if (fd < 0 || (count > 0 && !bodies)) {
+        return -1;
+    }
+    if (count > MAX_FRAMES_PER_WRITE) {
+        count = MAX_FRAMES_PER_WRITE;
+    }
+    // 长度头放栈上, 和载荷交错成iovec
+    uint32_t lens[MAX_FRAMES_PER_WRITE];
+    struct iovec iov[MAX_FRAMES_PER_WRITE * 3];
+    int iovcnt = 0;
+    for (size_t i = 0; i < count; ++i) {
+        std::string_view head = heads ? heads[i] : std::string_view();
+        lens[i] = htonl(static_cast<uint32_t>(head.size() + bodies[i].size()));
+        const char* seg_base[3] = {
+            reinterpret_cast<const char*>(&lens[i]), head.data(), bodies[i].data()
+        };
+        size_t seg_len[3] = {sizeof(uint32_t), head.size(), bodies[i].size()};
+        for (int k = 0; k < 3; ++k) {
+            // 跳过已经写出去的部分
+            if (skip >= seg_len[k]) {
+                skip -= seg_len[k];
+                continue;
+            }
+            iov[iovcnt].iov_base = const_cast<char*>(seg_base[k] + skip);
+            iov[iovcnt].iov_len = seg_len[k] - skip;
+            skip = 0;
+            ++iovcnt;
+        }
+    }
+    if (iovcnt == 0) {
+        return 0;
+    }
+
+    struct msghdr msg{};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+    while (true) {
+        ssize_t n = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        return n;
+    }
+}
+
+ssize_t write_file_frame_to(int fd, std::string_view head, int file_fd, off_t offset, size_t file_len, size_t skip) {
+    if (fd < 0 || (file_len > 0 && file_fd < 0)) {
+        return -1;
+    }
+    size_t mem_len = sizeof(uint32_t) + head.size();
+    ssize_t total = 0;
+    if (skip < mem_len) {
+        uint32_t net_len = htonl(static_cast<uint32_t>(head.size() + file_len));
+        const char* seg_base[2] = {reinterpret_cast<const char*>(&net_len), head.data()};
+        size_t seg_len[2] = {sizeof(uint32_t), head.size()};
+        struct iovec iov[2];
+        int iovcnt = 0;
+        size_t s = skip;
+        for (int k = 0; k < 2; ++k) {
+            if (s >= seg_len[k]) {
+                s -= seg_len[k];
+                continue;
+            }
+            iov[iovcnt].iov_base = const_cast<char*>(seg_base[k] + s);
+            iov[iovcnt].iov_len = seg_len[k] - s;
+            s = 0;
+            ++iovcnt;
+        }
+        struct msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+        ssize_t n;
+        while ((n = ::sendmsg(fd, &msg, MSG_NOSIGNAL)) == -1 && errno == EINTR) {}
+        if (n == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        total = n;
+        if (skip + static_cast<size_t>(n) < mem_len) {
+            return total; // 头都没写完, 发送缓冲区满了
+        }
+        skip = mem_len;
+    }
+    off_t off = offset + static_cast<off_t>(skip - mem_len);
+    size_t left = file_len - (skip - mem_len);
+    while (left > 0) {
+        ssize_t n = ::sendfile(fd, file_fd, &off, left);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return total > 0 ? total : -1;
+        }
+        if (n == 0) {
+            // 文件比预期短(被截断), 这一帧已经没法写完整了
+            return total > 0 ? total : -1;
+        }
+        total += n;
+        left -= static_cast<size_t>(n);
+    }
+    return total;
+}
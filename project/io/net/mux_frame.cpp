@@ -0,0 +1,61 @@
+#include "../include/mux_frame.hpp"
+#include "../include/ioaction.hpp"
+#include <algorithm>
+
+namespace mux {
+
+std::vector<std::string> split(int channel, std::string_view payload, size_t fragment) {
+    std::vector<std::string> frames;
+    size_t off = 0;
+    do {
+        size_t len = std::min(fragment, payload.size() - off);
+        bool more = off + len < payload.size();
+        std::string f;
+        f.reserve(1 + len);
+        f.push_back(header(channel, more));
+        f.append(payload.data() + off, len);
+        frames.push_back(std::move(f));
+        off += len;
+    } while (off < payload.size());
+    return frames;
+}
+
+bool reassembler::feed(std::string_view frame, int& channel, std::string_view& packet) {
+    if (frame.empty()) {
+        channel = -1;
+        return false;
+    }
+    uint8_t head = static_cast<uint8_t>(frame[0]);
+    channel = head & CHANNEL_MASK;
+    if (channel >= CHANNEL_NUM) {
+        channel = -1;
+        return false;
+    }
+    auto& buf = partial[channel];
+    if (consumed[channel]) {
+        buf.clear();
+        consumed[channel] = false;
+    }
+    frame.remove_prefix(1);
+    if (buf.size() + frame.size() > MAX_FRAME_SIZE) {
+        // 只发MORE不收尾的对端不能让缓冲无限长
+        buf.clear();
+        buf.shrink_to_fit();
+        channel = -1;
+        return false;
+    }
+    if (head & MORE) {
+        buf.append(frame.data(), frame.size());
+        return false;
+    }
+    if (buf.empty()) {
+        packet = frame; // 没分片, 直接交出去
+        return true;
+    }
+    buf.append(frame.data(), frame.size());
+    packet = buf;
+    consumed[channel] = true;
+    return true;
+}
+
+}
@@ -0,0 +1,263 @@
+#include "../include/outbound_queue.hpp"
+#include "../include/ioaction.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <string_view>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+    constexpr size_t HEADER_SIZE = sizeof(uint32_t);
+}
+
+bool outbound_queue::above_high_locked() const {
+    return queued_bytes > lim.high_bytes || queued_frames > lim.high_frames;
+}
+
+bool outbound_queue::below_low_locked() const {
+    return queued_bytes <= lim.low_bytes && queued_frames <= lim.low_frames;
+}
+
+std::shared_ptr<shared_file> shared_file::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+    return std::shared_ptr<shared_file>(new shared_file(fd));
+}
+
+shared_file::~shared_file() {
+    ::close(fd);
+}
+
+size_t outbound_queue::entry::wire_size() const {
+    return HEADER_SIZE + frame.size() + file_len + body_view.size();
+}
+
+outbound_queue::entry outbound_queue::entry::memory(std::string frame) {
+    entry e;
+    e.frame = std::move(frame);
+    return e;
+}
+
+outbound_queue::entry outbound_queue::entry::from_file(std::string head, std::shared_ptr<shared_file> file,
+                                                       off_t offset, size_t len) {
+    entry e;
+    e.frame = std::move(head);
+    e.file = std::move(file);
+    e.offset = offset;
+    e.file_len = e.file ? len : 0;
+    return e;
+}
+
+outbound_queue::entry outbound_queue::entry::shared(std::string head, std::shared_ptr<const std::string> body,
+                                                    size_t offset, size_t len) {
+    entry e;
+    e.frame = std::move(head);
+    if (body) {
+        e.body_view = std::string_view(*body).substr(offset, len);
+        e.body = std::move(body);
+    }
+    return e;
+}
+
+void outbound_queue::batch::add(std::string frame) {
+    entries.push_back(entry::memory(std::move(frame)));
+}
+
+void outbound_queue::batch::add_file(std::string head, std::shared_ptr<shared_file> file,
+                                     off_t offset, size_t len) {
+    entries.push_back(entry::from_file(std::move(head), std::move(file), offset, len));
+}
+
+void outbound_queue::batch::add_shared(std::string head, std::shared_ptr<const std::string> body,
+                                       size_t offset, size_t len) {
+    entries.push_back(entry::shared(std::move(head), std::move(body), offset, len));
+}
+
+outbound_queue::PushResult outbound_queue::push(std::string frame, int lane) {
+    return push_entry(entry::memory(std::move(frame)), lane);
+}
+
+outbound_queue::PushResult outbound_queue::push_file(std::string head, std::shared_ptr<shared_file> file,
+                                                     off_t offset, size_t len, int lane) {
+    return push_entry(entry::from_file(std::move(head), std::move(file), offset, len), lane);
+}
+
+outbound_queue::PushResult outbound_queue::push_shared(std::string head, std::shared_ptr<const std::string> body,
+                                                       size_t offset, size_t len, int lane) {
+    return push_entry(entry::shared(std::move(head), std::move(body), offset, len), lane);
+}
+
+outbound_queue::PushResult outbound_queue::push_many(batch frames, int lane) {
+    if (lane < 0 || lane >= MAX_LANES) {
+        lane = 0;
+    }
+    size_t wire = 0;
+    for (const auto& e : frames.entries) {
+        wire += e.wire_size();
+    }
+    size_t count = frames.entries.size();
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (closed) {
+        return PushResult::Closed;
+    }
+    if (queued_bytes + wire > lim.max_bytes || queued_frames + count > lim.max_frames) {
+        return PushResult::Overflow;
+    }
+    for (auto& e : frames.entries) {
+        lanes[lane].push_back(std::move(e));
+    }
+    queued_bytes += wire;
+    queued_frames += count;
+    return above_high_locked() ? PushResult::AboveHigh : PushResult::Queued;
+}
+
+outbound_queue::PushResult outbound_queue::push_entry(entry e, int lane) {
+    if (lane < 0 || lane >= MAX_LANES) {
+        lane = 0;
+    }
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (closed) {
+        return PushResult::Closed;
+    }
+    size_t wire = e.wire_size();
+    if (queued_bytes + wire > lim.max_bytes || queued_frames + 1 > lim.max_frames) {
+        return PushResult::Overflow;
+    }
+    lanes[lane].push_back(std::move(e));
+    queued_bytes += wire;
+    ++queued_frames;
+    return above_high_locked() ? PushResult::AboveHigh : PushResult::Queued;
+}
+
+outbound_queue::FlushResult outbound_queue::flush(int fd) {
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    if (flushing) {
+        return FlushResult::Busy;
+    }
+    if (queued_frames == 0) {
+        return FlushResult::Drained;
+    }
+    flushing = true;
+    std::string_view views[MAX_FRAMES_PER_WRITE];
+    std::string_view bodies[MAX_FRAMES_PER_WRITE];
+    int batch_lanes[MAX_FRAMES_PER_WRITE];
+    while (true) {
+        // 组一批: 写了一半的帧打头, 之后各通道轮流取
+        // 文件帧单独成批(sendfile一次只能写一个文件), 遇到就截断这一批
+        size_t count = 0;
+        size_t taken[MAX_LANES] = {0};
+        const entry* file_entry = nullptr;
+        if (partial_lane >= 0) {
+            const entry& e = lanes[partial_lane].front();
+            if (e.file) {
+                file_entry = &e;
+            }
+            views[count] = e.frame;
+            bodies[count] = e.body_view;
+            batch_lanes[count++] = partial_lane;
+            taken[partial_lane] = 1;
+        }
+        bool more = file_entry == nullptr;
+        while (more && count < MAX_FRAMES_PER_WRITE) {
+            more = false;
+            for (int k = 0; k < MAX_LANES && count < MAX_FRAMES_PER_WRITE; ++k) {
+                int l = (rr_next + k) % MAX_LANES;
+                if (taken[l] < lanes[l].size()) {
+                    const entry& e = lanes[l][taken[l]];
+                    if (e.file) {
+                        if (count == 0) {
+                            file_entry = &e;
+                            views[count] = e.frame;
+                            bodies[count] = e.body_view;
+                            batch_lanes[count++] = l;
+                        }
+                        more = false;
+                        break;
+                    }
+                    views[count] = e.frame;
+                    bodies[count] = e.body_view;
+                    batch_lanes[count++] = l;
+                    ++taken[l];
+                    more = true;
+                }
+            }
+        }
+        size_t skip = front_offset;
+
+        // 只有flush线程会出队, 写的时候不用持锁
+        lock.unlock();
+        ssize_t n = file_entry
+            ? ::write_file_frame_to(fd, file_entry->frame, file_entry->file->get_fd(),
+                                    file_entry->offset, file_entry->file_len, skip)
+            : ::write_frames_to(fd, views, bodies, count, skip);
+        lock.lock();
+
+        if (n <= 0) {
+            flushing = false;
+            return n == 0 ? FlushResult::Blocked : FlushResult::Error;
+        }
+
+        // 按写出的字节数推进, 最后一帧可能只写了一部分
+        size_t left = static_cast<size_t>(n);
+        queued_bytes -= left;
+        for (size_t i = 0; i < count && left > 0; ++i) {
+            int l = batch_lanes[i];
+            size_t remain = lanes[l].front().wire_size() - front_offset;
+            if (left >= remain) {
+                left -= remain;
+                lanes[l].pop_front();
+                --queued_frames;
+                front_offset = 0;
+                partial_lane = -1;
+                rr_next = (l + 1) % MAX_LANES;
+            } else {
+                front_offset += left;
+                partial_lane = l;
+                left = 0;
+            }
+        }
+        if (below_low_locked()) {
+            m_Condition.notify_all();
+        }
+        if (queued_frames == 0) {
+            flushing = false;
+            return FlushResult::Drained;
+        }
+    }
+}
+
+void outbound_queue::close() {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    closed = true;
+    m_Condition.notify_all();
+}
+
+size_t outbound_queue::bytes() {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return queued_bytes;
+}
+
+size_t outbound_queue::frames() {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return queued_frames;
+}
+
+bool outbound_queue::above_high() {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return above_high_locked();
+}
+
+bool outbound_queue::below_low() {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return below_low_locked();
+}
+
+bool outbound_queue::wait_below_low(std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    bool ok = m_Condition.wait_for(lock, timeout, [this] {
+        return closed || below_low_locked();
+    });
+    return ok && !closed;
+}
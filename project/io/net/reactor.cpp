@@ -2,97 +2,163 @@
 #include "../../global/include/logging.hpp"
 #include <sys/socket.h>
 #include <fcntl.h>
+#include <sys/eventfd.h>
+
+namespace {
+    constexpr uint32_t MODE_BITS = EPOLLET | EPOLLONESHOT;
+}
 
 event::event(int fd, uint32_t ev, TcpServerConnection* conn, std::function<void()> cb)
-    : fd(fd), events(ev), conn(conn), call_back_func(cb), in_reactor(false), binded(false), pr(nullptr) {}
+    : fd(fd), oneshot(ev & EPOLLONESHOT), events(ev & ~EPOLLONESHOT), conn(conn), call_back_func(cb) {}
 
 event::event(int fd, uint32_t ev)
-    : fd(fd), events(ev), in_reactor(false), binded(false), pr(nullptr) {}
+    : fd(fd), oneshot(ev & EPOLLONESHOT), events(ev & ~EPOLLONESHOT) {}
 
 event::event(int fd, uint32_t ev, TcpServerConnection* conn)
-    : fd(fd), events(ev), conn(conn), in_reactor(false), binded(false), pr(nullptr) {}
+    : fd(fd), oneshot(ev & EPOLLONESHOT), events(ev & ~EPOLLONESHOT), conn(conn) {}
 
 event::~event() {
-    fd = -1;
-    if (in_reactor) {
-        remove_from_reactor();
-        in_reactor = false;
+    if (binded && owner == this && registered) {
+        ctl(EPOLL_CTL_DEL, 0);
+        registered = false;
     }
-    if (binded) {
-        pr = nullptr;
-        binded = false;
+    // fd会被复用, 槽位里不能留着悬空指针
+    if (slot) {
+        if (slot->read == this) slot->read = nullptr;
+        if (slot->write == this) slot->write = nullptr;
+        slot = nullptr;
+    }
+    if (peer) {
+        // 拆开配对, 对方变回独立事件
+        if (peer->owner == this) {
+            peer->owner = peer;
+            peer->armed = 0;
+            peer->registered = false;
+        }
+        peer->peer = nullptr;
     }
+    fd = -1;
+    pr = nullptr;
+    binded = false;
 }
 
-void event::set(uint32_t ev) { events = ev; }
+void event::set(uint32_t ev) {
+    oneshot = ev & EPOLLONESHOT;
+    events = ev & ~EPOLLONESHOT;
+}
 void event::set(std::function<void()> cb) { call_back_func = cb; }
-void event::set(uint32_t ev, std::function<void()> cb) { events = ev; call_back_func = cb; }
+void event::set(uint32_t ev, std::function<void()> cb) { set(ev); call_back_func = cb; }
 
 void event::bind_with(reactor* re) {
-    if (re == nullptr || binded || in_reactor) {
+    if (re == nullptr || binded || in_epoll()) {
         throw std::runtime_error(std::string(__func__) + " No need to bind with reactor\n");
     }
     pr = re;
+    slot = re->slot_of(fd);
     binded = true;
 }
 
+void event::pair_with(event* other) {
+    if (other == nullptr || other == this || other->fd != fd || other->pr != pr) {
+        throw std::runtime_error(std::string(__func__) + ": Invalid event to pair with\n");
+    }
+    if (registered || other->registered) {
+        throw std::runtime_error(std::string(__func__) + ": Pair events before adding them to reactor\n");
+    }
+    peer = other;
+    other->peer = this;
+    other->owner = this;
+}
+
+uint32_t event::interest() const {
+    return events & ~MODE_BITS;
+}
+
+bool event::oneshot_mode() const {
+    return oneshot || (peer && peer->oneshot);
+}
+
+int event::ctl(int op, uint32_t mask) {
+    struct epoll_event ev = {0, {0}};
+    ev.events = mask | (events & EPOLLET);
+    if (peer) ev.events |= peer->events & EPOLLET;
+    if (oneshot_mode()) ev.events |= EPOLLONESHOT;
+    ev.data.ptr = slot;
+    pr->ctl_calls.fetch_add(1, std::memory_order_relaxed);
+    int result = epoll_ctl(pr->epoll_fd, op, fd, op == EPOLL_CTL_DEL ? nullptr : &ev);
+    if (result < 0) {
+        log_error("epoll_ctl {} failed for fd={}: {}",
+                  op == EPOLL_CTL_ADD ? "ADD" : op == EPOLL_CTL_MOD ? "MOD" : "DEL", fd, strerror(errno));
+    }
+    return result;
+}
+
 void event::add_to_reactor() {
-    add_event_to_fd();
-    in_reactor = true;
+    pr->run_in_loop([this]() {
+        add_event_to_fd();
+    });
 }
 
 void event::remove_from_reactor() {
-    remove_event_from_fd();
-    in_reactor = false;
+    pr->run_in_loop([this]() {
+        remove_event_from_fd();
+    });
 }
 
 void event::add_event_to_fd() {
-    if (pr->fd_events_map.find(fd) != pr->fd_events_map.end()) {
-        if (pr->fd_events_map[fd] & events) {
-            return;
-        }
-        struct epoll_event ev = {0, {0}};
-        ev.events = pr->fd_events_map[fd] | events;
-        ev.data.fd = fd;
-        uint32_t new_events = ev.events;  // 复制到临时变量
-        log_info("MOD: fd={}, old_events={:#x}, new_events={:#x}", fd, pr->fd_events_map[fd], new_events);
-        int result = epoll_ctl(pr->epoll_fd, EPOLL_CTL_MOD, fd, &ev);
-        if (result < 0) {
-            log_error("epoll_ctl MOD failed for fd={}: {}", fd, strerror(errno));
-        }
-        pr->fd_events_map[fd] = ev.events;
+    event* o = owner;
+    uint32_t want = interest();
+    if ((o->armed & want) == want) {
+        return; // 已经布防
+    }
+    o->armed |= want;
+    if (o->registered) {
+        o->ctl(EPOLL_CTL_MOD, o->armed);
+    } else if (o->ctl(EPOLL_CTL_ADD, o->armed) == 0) {
+        o->registered = true;
     } else {
-        pr->fd_events_map[fd] = events;
-        struct epoll_event ev = {0, {0}};
-        ev.events = events;
-        ev.data.fd = fd;
-        int result = epoll_ctl(pr->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
-        if (result < 0) {
-            log_error("epoll_ctl ADD failed for fd={}: {}", fd, strerror(errno));
-        } else if (events & EPOLLOUT) {
-            log_info("Write event registered for fd={}, waiting for trigger", fd);
-        }
+        o->armed &= ~want;
     }
 }
 
 void event::remove_event_from_fd() {
-    if (pr->fd_events_map.find(fd) == pr->fd_events_map.end()) {
-        return; // 没有事件绑定
-    }
-    if (pr->fd_events_map[fd] & events) {
-        pr->fd_events_map[fd] &= ~events; // 移除事件
-        if (pr->fd_events_map[fd] == 0) {
-            pr->fd_events_map.erase(fd); // 如果没有事件了, 删除映射
-            epoll_ctl(pr->epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
-        } else {
-            struct epoll_event ev = {0, {0}};
-            ev.events = pr->fd_events_map[fd];
-            ev.data.fd = fd;
-            epoll_ctl(pr->epoll_fd, EPOLL_CTL_MOD, fd, &ev);
-        }
+    event* o = owner;
+    uint32_t want = interest();
+    if (!(o->armed & want)) {
+        return; // 没布防, 或者一次性事件已经触发过
+    }
+    o->armed &= ~want;
+    if (!o->registered) {
+        return;
+    }
+    if (o->armed == 0 && !o->oneshot_mode()) {
+        o->ctl(EPOLL_CTL_DEL, 0);
+        o->registered = false;
+    } else {
+        // 一次性模式保留登记, 下次布防还是一次MOD
+        o->ctl(EPOLL_CTL_MOD, o->armed);
     }
 }
 
+uint32_t event::on_fire(uint32_t revents) {
+    event* o = owner;
+    if (!o->oneshot_mode()) {
+        return revents; // 持久模式, 原样分发
+    }
+    uint32_t fired = revents;
+    if (revents & (EPOLLERR | EPOLLHUP)) {
+        fired |= o->armed; // 出错/挂断交给所有已布防的事件处理
+    }
+    fired &= o->armed;
+    // 内核已经把整个fd撤防了, 没触发的那一半补回去
+    uint32_t remain = o->armed & ~fired;
+    o->armed = remain;
+    if (remain) {
+        o->ctl(EPOLL_CTL_MOD, remain);
+    }
+    return fired;
+}
+
 void event::call_back() {
     if (call_back_func) {
         call_back_func();
@@ -100,25 +166,33 @@ void event::call_back() {
 }
 
 bool event::is_binded() const { return binded; }
-bool event::in_epoll() const { return in_reactor; }
+bool event::is_oneshot() const { return oneshot; }
+bool event::in_epoll() const { return (owner->armed & interest()) != 0; }
 int event::get_sockfd() const { return fd; }
 void event::set_sockfd(int new_fd) { fd = new_fd; }
 
-reactor::reactor() {
+reactor::reactor() : slot_chunks(new std::atomic<event_slot*>[SLOT_CHUNK_NUM]()) {
     epoll_fd = epoll_create1(0);
     epoll_events = new epoll_event[max_events];
+    init_wakeup();
 }
 
 reactor::reactor(int max_events, int timeout)
-    : max_events(max_events), epoll_timeout(timeout), epoll_fd(-1), epoll_events(nullptr) {
+    : epoll_fd(-1), max_events(max_events), epoll_timeout(timeout),
+      slot_chunks(new std::atomic<event_slot*>[SLOT_CHUNK_NUM]()), epoll_events(nullptr) {
     epoll_fd = epoll_create1(0);
     if (epoll_fd < 0) {
         throw std::runtime_error(std::string(__func__) + ": Failed to create epoll instance - " + strerror(errno) + '\n');
     }
     epoll_events = new epoll_event[max_events];
+    init_wakeup();
 }
 
 reactor::~reactor() {
+    if (wake_fd >= 0) {
+        close(wake_fd);
+        wake_fd = -1;
+    }
     if (epoll_fd >= 0) {
         close(epoll_fd);
         epoll_fd = -1;
@@ -127,33 +201,170 @@ reactor::~reactor() {
         delete[] epoll_events;
         epoll_events = nullptr;
     }
+    for (int i = 0; i < SLOT_CHUNK_NUM; ++i) {
+        delete[] slot_chunks[i].load(std::memory_order_relaxed);
+    }
 }
 
 void reactor::add_revent(event* ev, int fd) {
     if (ev == nullptr || fd < 0) {
         throw std::runtime_error(std::string(__func__) + ": Invalid event or file descriptor\n");
     }
-    fd_event_obj[fd].first = ev;
+    event_slot* sl = slot_of(fd);
+    sl->read = ev;
+    if (sl->write) {
+        ev->pair_with(sl->write);
+    }
 }
 
 void reactor::add_wevent(event* ev, int fd) {
     if (ev == nullptr || fd < 0) {
         throw std::runtime_error(std::string(__func__) + ": Invalid event or file descriptor\n");
     }
-    fd_event_obj[fd].second = ev;
+    event_slot* sl = slot_of(fd);
+    sl->write = ev;
+    if (sl->read) {
+        sl->read->pair_with(ev);
+    }
+}
+
+event_slot* reactor::slot_of(int fd) {
+    if (fd < 0 || (fd >> SLOT_CHUNK_BITS) >= SLOT_CHUNK_NUM) {
+        throw std::out_of_range(std::string(__func__) + ": fd out of range: " + std::to_string(fd));
+    }
+    size_t ci = static_cast<size_t>(fd) >> SLOT_CHUNK_BITS;
+    size_t si = static_cast<size_t>(fd) & ((1u << SLOT_CHUNK_BITS) - 1);
+    event_slot* chunk = slot_chunks[ci].load(std::memory_order_acquire);
+    if (chunk == nullptr) {
+        std::lock_guard<std::mutex> lock(slot_mutex);
+        chunk = slot_chunks[ci].load(std::memory_order_relaxed);
+        if (chunk == nullptr) {
+            chunk = new event_slot[1u << SLOT_CHUNK_BITS];
+            for (size_t i = 0; i < (1u << SLOT_CHUNK_BITS); ++i) {
+                chunk[i].fd = static_cast<int>((ci << SLOT_CHUNK_BITS) | i);
+            }
+            slot_chunks[ci].store(chunk, std::memory_order_release);
+        }
+    }
+    return &chunk[si];
+}
+
+void reactor::init_wakeup() {
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0) {
+        throw std::runtime_error(std::string(__func__) + ": Failed to create eventfd - " + strerror(errno) + '\n');
+    }
+    wake_slot.fd = wake_fd;
+    struct epoll_event ev = {0, {0}};
+    ev.events = EPOLLIN;
+    ev.data.ptr = &wake_slot;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev) < 0) {
+        throw std::runtime_error(std::string(__func__) + ": Failed to register eventfd - " + strerror(errno) + '\n');
+    }
+}
+
+void reactor::drain_wakeup() {
+    uint64_t cnt;
+    while (read(wake_fd, &cnt, sizeof(cnt)) > 0) {}
+}
+
+void reactor::wakeup() {
+    uint64_t one = 1;
+    wakeups.fetch_add(1, std::memory_order_relaxed);
+    if (write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        log_error("Failed to wake up reactor: {}", strerror(errno));
+    }
+}
+
+void reactor::post(std::function<void()> cb) {
+    bool need_wake;
+    {
+        std::lock_guard<std::mutex> lock(task_mutex);
+        need_wake = tasks.empty();
+        tasks.push_back(std::move(cb));
+    }
+    // 队列本来非空说明已经唤醒过, reactor线程还没来得及取
+    if (need_wake) {
+        wakeup();
+    }
+}
+
+void reactor::run_in_loop(std::function<void()> cb) {
+    if (in_loop_thread()) {
+        cb();
+    } else {
+        post(std::move(cb));
+    }
+}
+
+bool reactor::in_loop_thread() const {
+    return loop_tid.load(std::memory_order_relaxed) == std::this_thread::get_id();
+}
+
+void reactor::run_pending() {
+    loop_tid.store(std::this_thread::get_id(), std::memory_order_relaxed);
+    std::vector<std::function<void()>> batch;
+    {
+        std::lock_guard<std::mutex> lock(task_mutex);
+        batch.swap(tasks);
+    }
+    for (auto& task : batch) {
+        task();
+    }
+    timers.advance();
 }
 
 int reactor::wait() {
+    loop_tid.store(std::this_thread::get_id(), std::memory_order_relaxed);
     int ret;
     do {
-        ret = epoll_wait(epoll_fd, epoll_events, max_events, epoll_timeout);
+        wait_calls.fetch_add(1, std::memory_order_relaxed);
+        int timeout = epoll_timeout;
+        int next_tick = timers.next_timeout_ms();
+        if (next_tick >= 0 && (timeout < 0 || next_tick < timeout)) {
+            timeout = next_tick;
+        }
+        ret = epoll_wait(epoll_fd, epoll_events, max_events, timeout);
     } while (ret < 0 && errno == EINTR);
     if (ret < 0) {
         throw std::runtime_error(std::string(__func__) + ": Epoll wait failed\n");
     }
+    // 唤醒用的eventfd不交给调用方, 读空后从结果里摘掉
+    for (int i = 0; i < ret; ++i) {
+        if (epoll_events[i].data.ptr == &wake_slot) {
+            drain_wakeup();
+            epoll_events[i] = epoll_events[--ret];
+            break;
+        }
+    }
+    ready_events.fetch_add(ret, std::memory_order_relaxed);
     return ret;
 }
 
 int reactor::get_epoll_fd() const {
     return epoll_fd;
-}
\ No newline at end of file
+}
+
+timing_wheel::timer_id reactor::run_after(std::chrono::milliseconds delay, std::function<void()> cb) {
+    return timers.add(delay, std::move(cb));
+}
+
+bool reactor::cancel_timer(timing_wheel::timer_id id) {
+    return timers.cancel(id);
+}
+
+reactor_stats reactor::stats() const {
+    reactor_stats st;
+    st.ctl_calls = ctl_calls.load(std::memory_order_relaxed);
+    st.wait_calls = wait_calls.load(std::memory_order_relaxed);
+    st.ready_events = ready_events.load(std::memory_order_relaxed);
+    st.wakeups = wakeups.load(std::memory_order_relaxed);
+    return st;
+}
+
+void reactor::reset_stats() {
+    ctl_calls = 0;
+    wait_calls = 0;
+    ready_events = 0;
+    wakeups = 0;
+}
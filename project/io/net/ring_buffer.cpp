@@ -0,0 +1,88 @@
+#include "../include/ring_buffer.hpp"
+#include <sys/uio.h>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+    constexpr size_t SHRINK_THRESHOLD = 1024 * 1024; // 读空后超过这个容量就缩回去
+
+    size_t round_up_pow2(size_t n) {
+        size_t p = 1;
+        while (p < n) p <<= 1;
+        return p;
+    }
+}
+
+ring_buffer::ring_buffer(size_t capacity)
+    : cap(round_up_pow2(std::max<size_t>(capacity, 64))) {
+    init_cap = cap;
+    buf.reset(new char[cap]);
+}
+
+void ring_buffer::linearize(size_t new_cap) {
+    size_t n = readable();
+    size_t r = head & mask();
+    size_t first = std::min(n, cap - r);
+    if (new_cap == cap) {
+        // 容量不变, 原地旋转
+        std::rotate(buf.get(), buf.get() + r, buf.get() + cap);
+    } else {
+        std::unique_ptr<char[]> nb(new char[new_cap]);
+        memcpy(nb.get(), buf.get() + r, first);
+        memcpy(nb.get() + first, buf.get(), n - first);
+        buf.swap(nb);
+        cap = new_cap;
+    }
+    head = 0;
+    tail = n;
+}
+
+ssize_t ring_buffer::read_fd(int fd) {
+    size_t free_len = writable();
+    size_t w = tail & mask();
+    size_t first = std::min(free_len, cap - w);
+    struct iovec iov[2];
+    iov[0].iov_base = buf.get() + w;
+    iov[0].iov_len = first;
+    iov[1].iov_base = buf.get();
+    iov[1].iov_len = free_len - first;
+    ssize_t n = ::readv(fd, iov, iov[1].iov_len > 0 ? 2 : 1);
+    if (n > 0) {
+        tail += static_cast<size_t>(n);
+    }
+    return n;
+}
+
+void ring_buffer::peek(void* dst, size_t len, size_t offset) const {
+    size_t r = (head + offset) & mask();
+    size_t first = std::min(len, cap - r);
+    memcpy(dst, buf.get() + r, first);
+    memcpy(static_cast<char*>(dst) + first, buf.get(), len - first);
+}
+
+std::string_view ring_buffer::contiguous(size_t offset, size_t len) {
+    size_t start = (head + offset) & mask();
+    if (start + len > cap) {
+        // 跨环尾了, 整理一次
+        linearize(cap);
+        start = offset;
+    }
+    return std::string_view(buf.get() + start, len);
+}
+
+void ring_buffer::consume(size_t len) {
+    head += std::min(len, readable());
+    if (head == tail) {
+        head = tail = 0;
+        if (cap >= SHRINK_THRESHOLD && cap > init_cap) {
+            buf.reset(new char[init_cap]);
+            cap = init_cap;
+        }
+    }
+}
+
+void ring_buffer::reserve(size_t len) {
+    if (len > cap) {
+        linearize(round_up_pow2(len));
+    }
+}
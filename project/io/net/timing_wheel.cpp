@@ -0,0 +1,85 @@
+#include "../include/timing_wheel.hpp"
+#include <algorithm>
+
+timing_wheel::timing_wheel(size_t slot_num, std::chrono::milliseconds tick)
+    : slots(std::max<size_t>(slot_num, 1)),
+      tick(std::max(tick, std::chrono::milliseconds(1))),
+      last_tick(clock::now()) {}
+
+timing_wheel::timer_id timing_wheel::add(std::chrono::milliseconds delay, std::function<void()> cb) {
+    std::lock_guard<std::recursive_mutex> lock(m_Mutex);
+    if (index.empty() && firing.empty()) {
+        // 空轮期间没人推进, 先把指针拨到现在, 免得新定时器被当成早已到期
+        auto now = clock::now();
+        auto behind = static_cast<size_t>((now - last_tick) / tick);
+        last_tick += behind * tick;
+        cursor = (cursor + behind) % slots.size();
+    }
+    // 向上取整到刻度, 至少一个刻度
+    size_t ticks = static_cast<size_t>((std::max<int64_t>(delay.count(), 0) + tick.count() - 1) / tick.count());
+    if (ticks == 0) ticks = 1;
+    size_t pos = (cursor + ticks) % slots.size();
+    size_t rounds = (ticks - 1) / slots.size();
+    timer_id id = next_id++;
+    auto& lst = slots[pos];
+    lst.push_back(node{id, rounds, std::move(cb)});
+    index[id] = {pos, std::prev(lst.end())};
+    return id;
+}
+
+bool timing_wheel::cancel(timer_id id) {
+    std::lock_guard<std::recursive_mutex> lock(m_Mutex);
+    auto it = index.find(id);
+    if (it == index.end()) {
+        return false;
+    }
+    auto [pos, nit] = it->second;
+    if (pos == FIRING) {
+        firing.erase(nit);
+    } else {
+        slots[pos].erase(nit);
+    }
+    index.erase(it);
+    return true;
+}
+
+void timing_wheel::advance(clock::time_point now) {
+    std::lock_guard<std::recursive_mutex> lock(m_Mutex);
+    while (now - last_tick >= tick) {
+        last_tick += tick;
+        cursor = (cursor + 1) % slots.size();
+        auto& lst = slots[cursor];
+        // 先把到期的挪出来, 回调里新加到当前槽位的要等下一圈
+        for (auto it = lst.begin(); it != lst.end();) {
+            if (it->rounds > 0) {
+                --it->rounds;
+                ++it;
+                continue;
+            }
+            auto next = std::next(it);
+            firing.splice(firing.end(), lst, it);
+            index[it->id].first = FIRING;
+            it = next;
+        }
+        while (!firing.empty()) {
+            auto cb = std::move(firing.front().cb);
+            index.erase(firing.front().id);
+            firing.pop_front();
+            if (cb) cb();
+        }
+    }
+}
+
+int timing_wheel::next_timeout_ms(clock::time_point now) {
+    std::lock_guard<std::recursive_mutex> lock(m_Mutex);
+    if (index.empty()) {
+        return -1;
+    }
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(last_tick + tick - now).count();
+    return left > 0 ? static_cast<int>(left) : 0;
+}
+
+size_t timing_wheel::size() {
+    std::lock_guard<std::recursive_mutex> lock(m_Mutex);
+    return index.size();
+}
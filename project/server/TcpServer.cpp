@@ -4,55 +4,114 @@
 #include "include/redis.hpp"
 #include "../io/include/Socket.hpp"
 #include "include/dispatcher.hpp"
+#include <pthread.h>
+#include <sched.h>
 
 namespace set_addr_s {
     Addr server_addr[3];
+    int loop_num = 1;
 }
 
-TcpServer::TcpServer(int idx) : idx(idx) {
-    pr = new reactor();
-    listen_conn = new ListenSocket(
-        set_addr_s::server_addr[idx].first,
-        set_addr_s::server_addr[idx].second,
-        true
-    );
+namespace {
+    // 把当前线程绑到指定核上, 失败只记日志
+    void pin_to_core(int core) {
+        int ncpu = static_cast<int>(std::thread::hardware_concurrency());
+        if (ncpu <= 0) return;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(core % ncpu, &set);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err != 0) {
+            log_error("Failed to pin reactor thread to core {}: {}", core % ncpu, strerror(err));
+        }
+    }
+}
+
+TcpServer::TcpServer(int idx, int loop_num) : idx(idx) {
+    if (loop_num < 1) loop_num = 1;
+    for (int i = 0; i < loop_num; ++i) {
+        reactors.push_back(new reactor());
+        auto lsock = new ListenSocket(
+            set_addr_s::server_addr[idx].first,
+            set_addr_s::server_addr[idx].second,
+            true
+        );
+        if (loop_num > 1) {
+            lsock->set_reuse_port();
+        }
+        listen_conns.push_back(lsock);
+    }
 }
 
 TcpServer::TcpServer(int idx, const std::string& ip, uint16_t port) : idx(idx) { // 这函数写的有点多余
-    pr = new reactor();
-    listen_conn = new ListenSocket(ip, port);
+    reactors.push_back(new reactor());
+    listen_conns.push_back(new ListenSocket(ip, port));
 }
 
 TcpServer::~TcpServer() {
     log_info("Tcp server {} is being destroyed", idx);
-    delete listen_conn;
-    delete pr;
+    if (!loop_threads.empty()) {
+        stop();
+    }
+    for (auto lsock : listen_conns) delete lsock;
+    for (auto pr : reactors) delete pr;
+}
+
+int TcpServer::get_lfd(int loop_idx) const {
+    return loop_idx < (int)listen_conns.size() ? listen_conns[loop_idx]->get_fd() : -1;
+}
+
+int TcpServer::get_efd(int loop_idx) const {
+    return loop_idx < (int)reactors.size() ? reactors[loop_idx]->get_epoll_fd() : -1;
 }
 
-int TcpServer::get_lfd() const {
-    return listen_conn ? listen_conn->get_fd() : -1;
+thread_pool::Priority TcpServer::priority_of(const TcpServerConnection* conn) const {
+    return conn->mux ? thread_pool::Priority::Normal : task_pri;
 }
 
-int TcpServer::get_efd() const {
-    return pr ? pr->get_epoll_fd() : -1;
+int TcpServer::get_loop_num() const {
+    return static_cast<int>(reactors.size());
 }
 
 void TcpServer::init(thread_pool* pool, Dispatcher* disp) {
     this->pool = pool;
     this->disp = disp;
+    task_pri = idx == 1 ? thread_pool::Priority::Critical
+             : idx == 2 ? thread_pool::Priority::Bulk
+             : thread_pool::Priority::Normal;
     disp->add_server(this, idx);
     // 监听不用write event, 更不用创建TcpServerConnection
-    if (!(listen_conn->bind() && listen_conn->listen())) {
-        throw std::runtime_error("Failed to start listening on " + listen_conn->get_ip() + ":" + std::to_string(listen_conn->get_port()) + ": " + strerror(errno));
+    for (size_t i = 0; i < reactors.size(); ++i) {
+        auto lsock = listen_conns[i];
+        if (!(lsock->bind() && lsock->listen())) {
+            throw std::runtime_error("Failed to start listening on " + lsock->get_ip() + ":" + std::to_string(lsock->get_port()) + ": " + strerror(errno));
+        }
+        event* read_event = new event(lsock->get_fd(), EPOLLIN | EPOLLET);
+        read_event->bind_with(reactors[i]);
+        reactors[i]->add_revent(read_event, lsock->get_fd());
+        read_event->add_to_reactor();
     }
-    event* read_event = new event(listen_conn->get_fd(), EPOLLIN | EPOLLET);
-    read_event->bind_with(pr);
-    pr->add_revent(read_event, listen_conn->get_fd());
-    read_event->add_to_reactor();
 }
 
 void TcpServer::start() {
     running = true;
+    // 主循环不再占线程池的worker, 处理函数排满时也不会拖慢accept和事件分发
+    bool pin = reactors.size() > 1;
+    for (int i = 0; i < (int)reactors.size(); ++i) {
+        int core = idx * (int)reactors.size() + i;
+        loop_threads.emplace_back([this, i, core, pin]() {
+            if (pin) {
+                pin_to_core(core);
+            }
+            loop(i);
+        });
+    }
+    log_info("Tcp server {} started {} reactor threads", idx, reactors.size());
+}
+
+void TcpServer::loop(int loop_idx) {
+    reactor* pr = reactors[loop_idx];
+    int lfd = listen_conns[loop_idx]->get_fd();
     // main loop
     while (running) {
         int num_ready = pr->wait();
@@ -60,79 +119,130 @@ void TcpServer::start() {
             if (errno == EINTR) {
                 continue; // 被打断
             }
-            log_error(std::string("Epoll wait failed: ") + strerror(errno));
+            log_error("Epoll wait failed: {}", strerror(errno));
             running = false;
             break; // Exit on error
-        } else if (num_ready == 0) {
-            //log_info("Epoll wait timed out");
-            continue; // 超时, 无事发生
         }
         // 轮询
         for (int i = 0; i < num_ready; ++i) {
             auto ev = pr->epoll_events[i];
-            int fd = ev.data.fd;
-            event* read_event = pr->fd_event_obj[fd].first;
-            event* write_event = pr->fd_event_obj[fd].second;
+            auto slot = static_cast<event_slot*>(ev.data.ptr);
+            int fd = slot->fd;
+            event* read_event = slot->read;
+            event* write_event = slot->write;
             // 先拉出来listen_conn的事件
-            if (fd == listen_conn->get_fd()) {
-                this->pool->submit([this]() {
-                    this->auto_accept();
-                });
+            if (fd == lfd) {
+                // 边沿触发, 在reactor线程里一次接受完
+                auto_accept(loop_idx);
                 continue;
             }
+            if (read_event == nullptr) {
+                continue; // 连接已经销毁
+            }
+            // 一次性布防: 内核已撤防, 处理完由dispatch_*重新布防(一次MOD)
+            uint32_t fired = read_event->on_fire(ev.events);
             // 区分读写, 分发事件
-            if (ev.events & EPOLLIN) {
+            if (fired & EPOLLIN) {
                 // 读事件
-                log_info("Reactor read event at fd {}", fd);
-                read_event->remove_from_reactor();
-                //log_debug("Read event removed from reactor (fd:{})", fd);
-                pool->submit([read_event]() {
+                log_debug("Reactor read event at fd {}", fd);
+                pool->post([read_event]() {
                     read_event->conn->dispatcher \
                     ->dispatch_recv(read_event->conn);
-                });
+                }, priority_of(read_event->conn));
             }
-            if (ev.events & EPOLLOUT) {
+            if (fired & EPOLLOUT) {
                 // 写事件
-                log_info("Reactor write event at fd {}", fd);
-                write_event->remove_from_reactor();
-                //log_debug("Write event removed from reactor (fd:{})", fd);
-                pool->submit([write_event]() {
+                log_debug("Reactor write event at fd {}", fd);
+                pool->post([write_event]() {
                     write_event->conn->dispatcher \
                     ->dispatch_send(write_event->conn);
-                });
+                }, priority_of(write_event->conn));
             }
         }
+        // 其他线程投递来的任务(布防/注册/销毁连接), 以及到期的定时器
+        pr->run_pending();
     }
-    //log_debug("Tcp server {} main loop exited", idx);
+    //log_debug("Tcp server {} main loop {} exited", idx, loop_idx);
 }
 
 void TcpServer::stop() {
     running = false;
+    // 不用等epoll_wait超时, 直接唤醒
+    for (auto pr : reactors) {
+        pr->wakeup();
+    }
+    for (auto& t : loop_threads) {
+        if (t.joinable() && t.get_id() != std::this_thread::get_id()) {
+            t.join();
+        }
+    }
+    loop_threads.clear();
     log_info("Tcp server {} stopped", idx);
 }
 
-void TcpServer::auto_accept() {
-    auto new_sock = listen_conn->accept();
-    if (!new_sock) {
+void TcpServer::auto_accept(int loop_idx) {
+    constexpr int MAX_ACCEPT_PER_ROUND = 256; // 一轮最多接受这么多, 免得饿着已有连接
+    reactor* pr = reactors[loop_idx];
+    ListenSocket* lsock = listen_conns[loop_idx];
+
+    std::vector<AcceptedSocket*> accepted;
+    bool drained = false;
+    while ((int)accepted.size() < MAX_ACCEPT_PER_ROUND) {
+        AcceptedSocket* new_sock = lsock->try_accept();
+        if (new_sock) {
+            accepted.push_back(new_sock);
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            drained = true;
+            break;
+        }
+        if (errno == ECONNABORTED || errno == EPROTO) {
+            continue; // 对端在accept前就断了, 跳过
+        }
+        // EMFILE/ENFILE等, 这一轮先停下, 过一会儿再试, 不然积压的连接要等下一个边沿
         log_error("Failed to accept new connection: {}", strerror(errno));
-        return;
+        pr->run_after(std::chrono::milliseconds(100), [this, loop_idx]() {
+            auto_accept(loop_idx);
+        });
+        drained = true;
+        break;
     }
-    auto conn = new TcpServerConnection(pr, disp);
-    conn->socket = std::move(new_sock);
-    if (idx == 1) {
-        conn->set_send_type(DataType::Command);
-    } else if (idx == 0) {
-        conn->set_send_type(DataType::Message);
+
+    // 批量注册, 已经在reactor线程里, 直接改槽位和epoll
+    for (AcceptedSocket* new_sock : accepted) {
+        int fd = new_sock->get_fd();
+        auto conn = new TcpServerConnection(pr, disp);
+        conn->socket = new_sock;
+        if (idx == 1) {
+            conn->set_send_type(DataType::Command);
+        } else if (idx == 0) {
+            conn->set_send_type(DataType::Message);
+        }
+        // 其他的动态设定
+        // 读写都是一次性布防, 写事件只在发送队列写不动时才布防
+        event* read_event = new event(fd, EPOLLIN | EPOLLET | EPOLLONESHOT, conn);
+        event* write_event = new event(fd, EPOLLOUT | EPOLLET | EPOLLONESHOT, conn);
+        read_event->bind_with(pr);
+        write_event->bind_with(pr);
+        conn->read_event = read_event;
+        conn->write_event = write_event;
+        pr->add_revent(read_event, fd);
+        pr->add_wevent(write_event, fd);
+        read_event->add_event_to_fd();
+        // 心跳和空闲检测只挂在命令连接上, 它断了整个用户就走断开流程
+        if (idx == 1) {
+            conn->start_idle_timer();
+        }
+    }
+    if (!accepted.empty()) {
+        log_info("Tcp server {} loop {} accepted {} connections", idx, loop_idx, accepted.size());
     }
-    // 其他的动态设定
-    event* read_event = new event(new_sock->get_fd(), EPOLLIN | EPOLLET, conn);
-    event* write_event = new event(new_sock->get_fd(), EPOLLOUT | EPOLLET, conn);
-    read_event->bind_with(pr);
-    write_event->bind_with(pr);
-    conn->read_event = read_event;
-    conn->write_event = write_event;
-    pr->add_revent(read_event, new_sock->get_fd());
-    pr->add_wevent(write_event, new_sock->get_fd());
-    read_event->add_to_reactor();
-    write_event->add_to_reactor();
-}
\ No newline at end of file
+
+    // 没接完, 边沿不会再来, 自己排到下一轮继续
+    if (!drained) {
+        pr->post([this, loop_idx]() {
+            auto_accept(loop_idx);
+        });
+    }
+}
@@ -4,16 +4,205 @@
 #include "../global/abstract/datatypes.hpp"
 //#include "../global/include/safe_queue.hpp"
 #include "include/dispatcher.hpp"
+#include "../global/include/logging.hpp"
+#include "../global/include/command.hpp"
 #include <chrono>
+#include <sys/socket.h>
+
+namespace {
+    int64_t steady_ms() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+}
 
 TcpServerConnection::TcpServerConnection(reactor* reactor_ptr, Dispatcher* disp)
-    : reactor_ptr(reactor_ptr), dispatcher(disp) {}
+    : last_active_ms(steady_ms()), reactor_ptr(reactor_ptr), dispatcher(disp) {}
 
 void TcpServerConnection::set_send_type(DataType type) {
     to_send_type = type;
 }
 
+bool TcpServerConnection::after_push(outbound_queue::PushResult res) {
+    if (res == outbound_queue::PushResult::Overflow) {
+        log_error("Outbound queue overflow (fd:{}, {} bytes / {} frames queued), dropping slow client {}",
+                  socket->get_fd(), write_queue.bytes(), write_queue.frames(), user_ID);
+        shutdown();
+        return false;
+    }
+    if (res == outbound_queue::PushResult::Closed) {
+        return false;
+    }
+    flush();
+    return true;
+}
+
+bool TcpServerConnection::send_frame(std::string frame, int channel) {
+    outbound_queue::PushResult res = outbound_queue::PushResult::Queued;
+    if (mux) {
+        // 一个包的分片整体入队, 别的线程往同一通道发的分片插不进来
+        outbound_queue::batch pieces;
+        for (auto& piece : mux::split(channel, frame)) {
+            pieces.add(std::move(piece));
+        }
+        res = write_queue.push_many(std::move(pieces), channel);
+    } else {
+        res = write_queue.push(std::move(frame));
+    }
+    return after_push(res);
+}
+
+bool TcpServerConnection::send_file_frame(std::string head, std::shared_ptr<shared_file> file,
+                                          off_t offset, size_t len, int channel) {
+    outbound_queue::PushResult res;
+    if (mux) {
+        // 载荷 = head + 文件区间, 按分片大小切, 每片前面加通道头, 整体入队
+        outbound_queue::batch pieces;
+        size_t total = head.size() + len;
+        size_t pos = 0;
+        do {
+            size_t piece = std::min(mux::FRAGMENT_SIZE, total - pos);
+            std::string part(1, mux::header(channel, pos + piece < total));
+            size_t head_part = pos < head.size() ? std::min(piece, head.size() - pos) : 0;
+            if (head_part > 0) {
+                part.append(head, pos, head_part);
+            }
+            size_t file_pos = pos + head_part - std::min(pos + head_part, head.size()); // 这一片的文件部分从哪开始
+            pieces.add_file(std::move(part), file, offset + static_cast<off_t>(file_pos), piece - head_part);
+            pos += piece;
+        } while (pos < total);
+        res = write_queue.push_many(std::move(pieces), channel);
+    } else {
+        res = write_queue.push_file(std::move(head), std::move(file), offset, len);
+    }
+    return after_push(res);
+}
+
+bool TcpServerConnection::send_shared_frame(std::shared_ptr<const std::string> frame, int channel) {
+    outbound_queue::PushResult res;
+    if (mux) {
+        // 各片引用同一个缓冲区, 整体入队
+        outbound_queue::batch pieces;
+        size_t total = frame->size();
+        size_t pos = 0;
+        do {
+            size_t piece = std::min(mux::FRAGMENT_SIZE, total - pos);
+            pieces.add_shared(std::string(1, mux::header(channel, pos + piece < total)), frame, pos, piece);
+            pos += piece;
+        } while (pos < total);
+        res = write_queue.push_many(std::move(pieces), channel);
+    } else {
+        size_t len = frame->size();
+        res = write_queue.push_shared(std::string(), std::move(frame), 0, len);
+    }
+    return after_push(res);
+}
+
+void TcpServerConnection::flush() {
+    switch (write_queue.flush(socket->get_fd())) {
+        case outbound_queue::FlushResult::Blocked: {
+            // 内核缓冲区满, 等EPOLLOUT再接着写
+            write_event->add_to_reactor();
+            break;
+        }
+        case outbound_queue::FlushResult::Error: {
+            log_error("Failed to flush outbound queue (fd:{}): {}", socket->get_fd(), strerror(errno));
+            shutdown();
+            return;
+        }
+        default:
+            break;
+    }
+    // 回到低水位, 恢复读
+    if (read_paused && write_queue.below_low()) {
+        bool expected = true;
+        if (read_paused.compare_exchange_strong(expected, false)) {
+            read_event->add_to_reactor();
+        }
+    }
+}
+
+bool TcpServerConnection::wait_writable(std::chrono::milliseconds timeout) {
+    if (!write_queue.above_high()) {
+        return true;
+    }
+    return write_queue.wait_below_low(timeout);
+}
+
+void TcpServerConnection::shutdown() {
+    write_queue.close();
+    if (socket) {
+        ::shutdown(socket->get_fd(), SHUT_RDWR);
+    }
+    // 读被暂停时要重新挂上, 否则收不到断开
+    if (read_paused.exchange(false) && read_event) {
+        read_event->add_to_reactor();
+    }
+}
+
+void TcpServerConnection::release() {
+    // 先关掉发送队列, 避免排队期间还有人往里塞
+    write_queue.close();
+    reactor_ptr->post([this]() {
+        delete this;
+    });
+}
+
+void TcpServerConnection::touch() {
+    last_active_ms.store(steady_ms(), std::memory_order_relaxed);
+}
+
+void TcpServerConnection::start_idle_timer() {
+    touch();
+    arm_idle_timer(HEARTBEAT_INTERVAL);
+}
+
+void TcpServerConnection::arm_idle_timer(std::chrono::milliseconds delay) {
+    idle_timer = reactor_ptr->run_after(delay, [this]() {
+        on_idle_timer();
+    });
+}
+
+void TcpServerConnection::on_idle_timer() {
+    // reactor线程, 持有时间轮的锁, 析构方的cancel会等这里返回
+    idle_timer = 0;
+    if (closing) {
+        return;
+    }
+    std::chrono::milliseconds idle(steady_ms() - last_active_ms.load(std::memory_order_relaxed));
+    if (idle >= IDLE_TIMEOUT) {
+        log_info("Connection fd {} idle for {}ms, closing (user: {})",
+                 socket->get_fd(), idle.count(), user_ID.empty() ? temp_user_ID : user_ID);
+        shutdown();
+        return;
+    }
+    if (idle >= HEARTBEAT_INTERVAL) {
+        // 直接入队, 不碰Redis
+        send_frame(create_command_string(Action::HEARTBEAT, "", {}));
+        arm_idle_timer(std::min(HEARTBEAT_INTERVAL, IDLE_TIMEOUT - idle));
+        return;
+    }
+    // 期间有过数据, 按最后活跃时间重新算
+    arm_idle_timer(HEARTBEAT_INTERVAL - idle);
+}
+
+void TcpServerConnection::stop_idle_timer() {
+    closing = true;
+    timing_wheel::timer_id id;
+    while ((id = idle_timer.load()) != 0) {
+        if (reactor_ptr->cancel_timer(id)) {
+            break;
+        }
+        // 没取消掉说明回调刚好在执行, 它可能换了新的定时器, 再看一次
+        if (idle_timer.load() == id) {
+            break;
+        }
+    }
+}
+
 TcpServerConnection::~TcpServerConnection() {
+    stop_idle_timer();
+    write_queue.close();
     if (read_event) {
         delete read_event;
     }
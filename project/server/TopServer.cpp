@@ -34,8 +34,15 @@ namespace mysql_config {
     }
 }
 
+namespace {
+    // 阻塞调用大部分时间在等网络, 线程数可以比核数多; 排满了由调用方原地执行
+    constexpr int BLOCKING_POOL_SIZE = 16;
+    constexpr size_t BLOCKING_QUEUE_LIMIT = 1024;
+}
+
 TopServer::TopServer() {
-    pool = new thread_pool(20);
+    pool = new thread_pool(std::max(4, static_cast<int>(std::thread::hardware_concurrency())));
+    blocking_pool = new thread_pool(BLOCKING_POOL_SIZE, BLOCKING_QUEUE_LIMIT);
     redis = new RedisController();
     mysql = new MySQLController(
         mysql_config::host,
@@ -45,9 +52,9 @@ TopServer::TopServer() {
         mysql_config::port
     );
     disp = new Dispatcher(redis, mysql);
-    message_server = new TcpServer(0);
-    command_server = new TcpServer(1);
-    data_server = new TcpServer(2);
+    message_server = new TcpServer(0, set_addr_s::loop_num);
+    command_server = new TcpServer(1, set_addr_s::loop_num);
+    data_server = new TcpServer(2, set_addr_s::loop_num);
     disp->add_server(message_server, 0);
     disp->add_server(command_server, 1);
     disp->add_server(data_server, 2);
@@ -60,11 +67,13 @@ TopServer::~TopServer() {
     delete data_server;
     delete disp;
     delete redis;
+    delete blocking_pool;
     delete pool;
 }
 
 bool TopServer::launch() {
     pool->init();
+    blocking_pool->init();
     if (!mysql->connect()) {
         log_error("Failed to connect to MySQL");
         return false;
@@ -72,22 +81,16 @@ bool TopServer::launch() {
 
     // 设置 SFileManager 的线程池
     disp->file_manager->set_thread_pool(pool);
+    disp->set_blocking_pool(blocking_pool);
 
     message_server->init(pool, disp);
     command_server->init(pool, disp);
     data_server->init(pool, disp);
-    pool->submit([this]() {
-        message_server->start();
-    });
-    log_info("Message server submited to thread pool");
-    pool->submit([this]() {
-        command_server->start();
-    });
-    log_info("Command server submited to thread pool");
-    pool->submit([this]() {
-        data_server->start();
-    });
-    log_info("Data server submited to thread pool");
+    // 主循环各自有专用线程, 不占线程池
+    message_server->start();
+    command_server->start();
+    data_server->start();
+    log_info("All servers started");
     return true;
 }
 
@@ -102,7 +105,10 @@ void TopServer::stop() {
     if (data_server) {
         data_server->stop();
     }
+    // 阻塞池的任务做完会往pool投回续, 所以先停它
+    blocking_pool->shutdown();
     pool->shutdown();
+    disp->conn_manager->stop_activity_tracker();
     mysql->disconnect();
     log_info("All servers stopped");
 }
@@ -0,0 +1,126 @@
+#include "include/activity_tracker.hpp"
+#include "include/redis.hpp"
+#include "include/mysql.hpp"
+#include "../global/include/logging.hpp"
+#include "../global/include/time_utils.hpp"
+
+ActivityTracker::ActivityTracker(RedisController* redis_con, MySQLController* mysql_con)
+    : redis_con(redis_con), mysql_con(mysql_con) {
+    flush_thread = std::thread([this] {
+        std::unique_lock<std::mutex> lock(wait_mutex);
+        while (running) {
+            wait_cv.wait_for(lock, FLUSH_INTERVAL, [this] { return !running; });
+            lock.unlock();
+            flush();
+            lock.lock();
+        }
+    });
+}
+
+ActivityTracker::~ActivityTracker() {
+    stop();
+}
+
+void ActivityTracker::stop() {
+    {
+        std::lock_guard<std::mutex> lock(wait_mutex);
+        running = false;
+    }
+    wait_cv.notify_all();
+    if (flush_thread.joinable()) {
+        flush_thread.join(); // 线程退出前已经刷过最后一次
+    }
+}
+
+ActivityTracker::shard& ActivityTracker::shard_of(const std::string& user_ID) {
+    return shards[std::hash<std::string>{}(user_ID) % SHARD_NUM];
+}
+
+void ActivityTracker::track(const std::string& user_ID) {
+    std::int64_t now = now_us();
+    shard& sh = shard_of(user_ID);
+    std::unique_lock<std::shared_mutex> lock(sh.m_Mutex);
+    auto& e = sh.users[user_ID];
+    if (!e) {
+        e = std::make_unique<entry>();
+        e->flushed = now; // 上线时已经直接写过一次状态
+    }
+    e->last_active.store(now, std::memory_order_relaxed);
+}
+
+void ActivityTracker::touch(const std::string& user_ID) {
+    std::int64_t now = now_us();
+    shard& sh = shard_of(user_ID);
+    std::shared_lock<std::shared_mutex> lock(sh.m_Mutex);
+    auto it = sh.users.find(user_ID);
+    if (it != sh.users.end()) {
+        it->second->last_active.store(now, std::memory_order_relaxed);
+    }
+}
+
+void ActivityTracker::enable_persist(const std::string& user_ID) {
+    shard& sh = shard_of(user_ID);
+    std::shared_lock<std::shared_mutex> lock(sh.m_Mutex);
+    auto it = sh.users.find(user_ID);
+    if (it != sh.users.end()) {
+        it->second->persist.store(true, std::memory_order_relaxed);
+    }
+}
+
+void ActivityTracker::forget(const std::string& user_ID) {
+    shard& sh = shard_of(user_ID);
+    std::unique_lock<std::shared_mutex> lock(sh.m_Mutex);
+    auto it = sh.users.find(user_ID);
+    if (it == sh.users.end()) {
+        return;
+    }
+    entry& e = *it->second;
+    std::int64_t last = e.last_active.load(std::memory_order_relaxed);
+    if (last != e.flushed && e.persist.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> retired_lock(retired_mutex);
+        retired.emplace_back(user_ID, last);
+    }
+    sh.users.erase(it);
+}
+
+void ActivityTracker::flush() {
+    std::vector<std::pair<std::string, std::int64_t>> redis_batch;
+    std::vector<std::pair<std::string, std::int64_t>> mysql_batch;
+    for (auto& sh : shards) {
+        std::shared_lock<std::shared_mutex> lock(sh.m_Mutex);
+        for (auto& [user_ID, e] : sh.users) {
+            std::int64_t last = e->last_active.load(std::memory_order_relaxed);
+            if (last == e->flushed) {
+                continue;
+            }
+            e->flushed = last;
+            redis_batch.emplace_back(user_ID, last);
+            if (e->persist.load(std::memory_order_relaxed) && user_ID[0] != '_') {
+                mysql_batch.emplace_back(user_ID, last);
+            }
+        }
+    }
+    {
+        // 在线的排前面, 同一个用户刚下线又上线时以新的为准
+        std::lock_guard<std::mutex> retired_lock(retired_mutex);
+        mysql_batch.insert(mysql_batch.end(), retired.begin(), retired.end());
+        retired.clear();
+    }
+
+    // 不持锁写Redis, 这期间下线的用户由脚本跳过, 不会被写回在线
+    if (!redis_batch.empty()) {
+        try {
+            redis_con->set_users_active(redis_batch);
+        } catch (const std::exception& e) {
+            log_error("Failed to flush activity of {} users to Redis: {}", redis_batch.size(), e.what());
+        }
+    }
+    if (!mysql_batch.empty()) {
+        if (!mysql_con->update_users_last_active(mysql_batch)) {
+            log_error("Failed to flush last_active of {} users to MySQL", mysql_batch.size());
+        }
+    }
+    if (!redis_batch.empty()) {
+        log_debug("Flushed activity: {} to Redis, {} to MySQL", redis_batch.size(), mysql_batch.size());
+    }
+}
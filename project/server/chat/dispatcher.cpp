@@ -4,6 +4,7 @@
 #include "../../global/include/logging.hpp"
 #include "../include/connection_manager.hpp"
 #include "sfile_manager.hpp"
+#include "../../global/include/alloc_counter.hpp"
 // #include "../../global/abstract/datatypes.hpp"
 
 using RecvState = DataSocket::RecvState;
@@ -43,8 +44,12 @@ void Dispatcher::add_server(TcpServer* server, int idx) {
     this->server[idx] = server;
 }
 
+void Dispatcher::set_blocking_pool(thread_pool* pool) {
+    blocking_pool = pool;
+}
+
 void Dispatcher::flush_cached_messages() {
-    server[0]->pool->submit([&](){
+    server[0]->pool->post([&](){
         size_t batch_size = 500;
         auto batch = redis_con->pop_chat_messages_batch(batch_size);
         if (batch.empty()) return;
@@ -58,83 +63,235 @@ void Dispatcher::flush_cached_messages() {
                 msg.payload().file_size(), msg.payload().file_hash()
             );
         }
-    });
+    }, thread_pool::Priority::Bulk);
+}
+
+const Dispatcher::recv_fn Dispatcher::recv_table[] = {
+    nullptr,                      // None
+    &Dispatcher::recv_message,    // Message
+    &Dispatcher::recv_command,    // Command
+    &Dispatcher::recv_file_chunk, // FileChunk
+    nullptr,                      // SyncItem
+    nullptr,                      // OfflineMessages
+};
+
+namespace {
+    constexpr uint64_t PARSE_REPORT_EVERY = 100000;
+
+    // 每个worker线程一份, 解帧缓冲和命令/分片消息跨批复用
+    struct recv_state {
+        wire::scratch sc;
+        uint64_t decode_allocs = 0; // 本帧解帧时的分配次数, 由recv_*接着算上解析
+        uint64_t frames = 0;
+        uint64_t allocs = 0;
+    };
+
+    recv_state& local_recv_state() {
+        thread_local recv_state st;
+        return st;
+    }
+
+    // 配了COUNT_ALLOCS才统计, 每PARSE_REPORT_EVERY帧打一次解帧加解析一共分配了几次
+    void count_parse_allocs(recv_state& st, uint64_t parse_allocs) {
+        if constexpr (alloc_counter::enabled) {
+            st.allocs += st.decode_allocs + parse_allocs;
+            if (++st.frames % PARSE_REPORT_EVERY == 0) {
+                log_info("Receive path: {} allocations while parsing the last {} frames", st.allocs, PARSE_REPORT_EVERY);
+                st.allocs = 0;
+            }
+        }
+    }
+    // 心跳和改连接自身状态的命令不查库, 就地处理; 其余都要查MySQL或者发邮件
+    bool is_blocking_action(Action action) {
+        switch (action) {
+            case Action::HEARTBEAT:
+            case Action::Remember_Connection:
+            case Action::Set_Temp_Connection:
+            case Action::Mux_Connection:
+            case Action::Wire_Version:
+                return false;
+            default:
+                return true;
+        }
+    }
+
+    // 写成协程的命令, 查库时挂起而不是整个转到阻塞池
+    bool is_coroutine_action(Action action) {
+        return action == Action::Sign_In || action == Action::Online_Init;
+    }
+}
+
+bool Dispatcher::recv_message(TcpServerConnection* conn, std::string_view body, std::string_view frame) {
+    // 只取转发要用的几个字段, 不建ChatMessage
+    recv_state& st = local_recv_state();
+    alloc_counter::scope parse_allocs;
+    wire::chat_view chat_msg;
+    bool parsed = chat_msg.parse(body);
+    count_parse_allocs(st, parse_allocs.since());
+    if (!parsed) {
+        log_error("Failed to parse ChatMessage from fd {}", conn->socket->get_fd());
+        return true;
+    }
+    // 消息接收, 原始包要转发/缓存, 在handle_recv里压缩时才拷出来; 只碰Redis, 就地处理
+    message_handler->handle_recv(chat_msg, frame);
+    return true;
+}
+
+bool Dispatcher::recv_command(TcpServerConnection* conn, std::string_view body, std::string_view frame) {
+    recv_state& st = local_recv_state();
+    alloc_counter::scope parse_allocs;
+    CommandRequest& cmd_req = st.sc.cmd;
+    bool parsed = cmd_req.ParseFromArray(body.data(), static_cast<int>(body.size()));
+    count_parse_allocs(st, parse_allocs.since());
+    if (!parsed) {
+        log_error("Failed to parse CommandRequest from fd {}", conn->socket->get_fd());
+        return true;
+    }
+    Action action = static_cast<Action>(cmd_req.action());
+    if (is_coroutine_action(action)) {
+        // 在当前worker上开始, 第一次查库就挂起返回; 协程结束后同样投回去接着读
+        // 复用的cmd_req被搬进协程帧, 下一帧解析时重新分配, 登录这类命令不在乎
+        co_spawn(command_handler->handle_recv_async(conn, std::move(cmd_req), std::string(frame)),
+            [this, conn]() {
+                server[1]->pool->post([this, conn]() {
+                    dispatch_recv(conn);
+                }, server[1]->priority_of(conn));
+            });
+        return false;
+    }
+    if (blocking_pool && is_blocking_action(action)) {
+        // 转到阻塞池执行, 做完再回到命令服务器的池子接着读这个连接;
+        // 期间读事件不布防, 同一连接的命令仍然一条一条按顺序处理
+        unique_task job([this, conn, cmd_req = std::move(cmd_req), ostr = std::string(frame)]() {
+            command_handler->handle_recv(conn, cmd_req, ostr);
+            server[1]->pool->post([this, conn]() {
+                dispatch_recv(conn);
+            }, server[1]->priority_of(conn));
+        });
+        if (!blocking_pool->try_post(std::move(job))) {
+            // 阻塞池排满了, 原地执行, 相当于给这个连接降速; 接着读同样交给投回去的续
+            log_error("Blocking pool is full ({} queued), running command inline", blocking_pool->queued_tasks());
+            job();
+        }
+        return false;
+    }
+    // 命令单向发送
+    command_handler->handle_recv(conn, cmd_req, std::string(frame));
+    return true;
+}
+
+bool Dispatcher::recv_file_chunk(TcpServerConnection* conn, std::string_view body, std::string_view) {
+    recv_state& st = local_recv_state();
+    alloc_counter::scope parse_allocs;
+    FileChunk& file_chunk = st.sc.chunk;
+    bool parsed = file_chunk.ParseFromArray(body.data(), static_cast<int>(body.size()));
+    count_parse_allocs(st, parse_allocs.since());
+    if (!parsed) {
+        log_error("Failed to parse FileChunk from fd {}", conn->socket->get_fd());
+        return true;
+    }
+    // 文件分片
+    file_handler->handle_recv(conn, file_chunk);
+    return true;
+}
+
+void Dispatcher::drop_connection(TcpServerConnection* conn) {
+    if (conn->user_ID.empty() && conn->temp_user_ID.empty()) {
+        log_error("Connection (t) ID is empty.");
+        // 正常来说，这不会发生
+    } else if (conn->user_ID.empty()) {
+        // 处理未登录用户的断开, 以前靠心跳线程回收, 现在在这里直接回收
+        log_info("unsigned user connection fd {} disconnected", conn->socket->get_fd());
+        conn_manager->destroy_connection(conn->temp_user_ID);
+    } else {
+        // 已登录用户, 先保存user_ID, 然后执行登出处理
+        std::string user_id = conn->user_ID;
+        log_debug("Processing sign out for user: {}", user_id);
+
+        // 注意：handle_sign_out 内部会调用 remove_user, 这会删除所有该用户的连接
+        // 包括当前的 conn 对象, 所以之后不能再使用 conn
+        command_handler->handle_uncommon_disconnect(user_id); // 非正常断开处理
+    }
+}
+
+bool Dispatcher::handle_frame(TcpServerConnection* conn, std::string_view frame) {
+    if (!conn->user_ID.empty())
+        conn_manager->update_user_activity(conn->user_ID);
+    else
+        conn_manager->update_user_activity(conn->temp_user_ID);
+
+    // 拆帧: v2直接读类型字节(压缩的先用连接自己的上下文解压), v1解析Envelope后按type_url查, 然后查表分发
+    recv_state& st = local_recv_state();
+    std::string_view body;
+    alloc_counter::scope decode_allocs;
+    DataType type = wire::decode(frame, body, st.sc, &conn->codec);
+    st.decode_allocs = decode_allocs.since();
+    size_t idx = static_cast<size_t>(type);
+    if (idx >= std::size(recv_table) || recv_table[idx] == nullptr) {
+        if (type == DataType::None) {
+            log_error("Failed to parse frame from fd {}", conn->socket->get_fd());
+        } else {
+            log_error("Unknown payload type"); // 剩下的不用服务器收
+        }
+        return true;
+    }
+    return (this->*recv_table[idx])(conn, body, frame);
 }
 
 void Dispatcher::dispatch_recv(TcpServerConnection* conn) {
     log_debug("dispatch_recv called for connection fd: {}", conn->socket->get_fd());
-    std::string proto_str;
+    std::string_view frame; // 指向连接的接收缓冲区, 不拷贝
     // 读
     while (1) {
-        RecvState state = conn->socket->receive_protocol_with_state(proto_str);
+        RecvState state = conn->socket->receive_frame(frame);
         if (state == RecvState::NoMoreData) {
             //log_debug("No more data available for fd: {}", conn->socket->get_fd());
             break;
         } else if (state == RecvState::Disconnected) {
             log_info("Connection fd {} disconnected", conn->socket->get_fd());
-            if (conn->user_ID.empty() && conn->temp_user_ID.empty()) {
-                log_error("Connection (t) ID is empty.");
-                // 正常来说，这不会发生
-            } else if (conn->user_ID.empty()) {
-                // 处理未登录用户的断开
-                log_info("unsigned user connection fd {} disconnected", conn->socket->get_fd());
-            } else {
-                // 已登录用户, 先保存user_ID, 然后执行登出处理
-                std::string user_id = conn->user_ID;
-                log_debug("Processing sign out for user: {}", user_id);
-
-                // 注意：handle_sign_out 内部会调用 remove_user, 这会删除所有该用户的连接
-                // 包括当前的 conn 对象, 所以之后不能再使用 conn
-                command_handler->handle_uncommon_disconnect(user_id); // 非正常断开处理
-                conn = nullptr;
-            }
+            drop_connection(conn);
             return; // 连接断开, 退出处理循环
         } else if (state == RecvState::Error) {
+            // 读出错或者长度头超限, 不再信任这条连接, 和断开一样回收
             log_error("Error receiving data from connection (fd: {})", conn->socket->get_fd());
-            return; // 处理错误
+            drop_connection(conn);
+            return;
         }
         //log_debug("Received data from connection (fd:{})", conn->socket->get_fd());
 
-        // 收到数据, 更新发送的用户活动时间
-        if (!conn->user_ID.empty())
-            conn_manager->update_user_activity(conn->user_ID);
-        else
-            conn_manager->update_user_activity(conn->temp_user_ID);
+        // 收到数据, 刷新连接的空闲计时, 更新发送的用户活动时间
+        conn->touch();
 
-        // 转写
-        Envelope env;
-        if (!env.ParseFromString(proto_str)) {
-            log_error("Failed to parse Envelope from received data");
-            break;
+        // 复用模式: 先按通道重组分片, 凑齐一个完整的包再往下走
+        if (conn->mux) {
+            int channel;
+            std::string_view packet;
+            if (!conn->mux_in.feed(frame, channel, packet)) {
+                if (channel < 0) {
+                    log_error("Invalid or oversized mux frame from fd {}", conn->socket->get_fd());
+                    drop_connection(conn);
+                    return;
+                }
+                continue;
+            }
+            frame = packet;
+            // 复用连接的读事件按Normal投递, 命令和文件分片换到各自通道的优先级处理, 不沾命令服务器的Critical
+            // 期间这个连接不读, 包的先后不变, packet指向的缓冲区也不会被动
+            thread_pool::Priority pri = server[channel]->task_pri;
+            if (pri != thread_pool::current_priority()) {
+                server[channel]->pool->post([this, conn, frame]() {
+                    if (handle_frame(conn, frame)) {
+                        server[1]->pool->post([this, conn]() {
+                            dispatch_recv(conn);
+                        }, server[1]->priority_of(conn));
+                    }
+                }, pri);
+                return;
+            }
         }
-        const google::protobuf::Any& any = env.payload();
-        //std::cout << "分发器测试类型[" << any.type_url() << "]" << std::endl;
-        if (any.Is<ChatMessage>()) {
-            ChatMessage chat_msg;
-            any.UnpackTo(&chat_msg);
-            // 消息接收
-            message_handler->handle_recv(chat_msg, proto_str);
-            // // 定时批量存储
-            // auto now = std::chrono::steady_clock::now();
-            // auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(now - last_flush_time);
-
-            // if (elapsed >= flush_interval) {
-            //     flush_cached_messages();
-            //     last_flush_time = now;
-            // }
-        } else if (any.Is<CommandRequest>()) {
-            CommandRequest cmd_req;
-            any.UnpackTo(&cmd_req);
-            // 命令单向发送
-            command_handler->handle_recv(conn, cmd_req, proto_str);
-        } else if (any.Is<FileChunk>()) {
-            FileChunk file_chunk;
-            any.UnpackTo(&file_chunk);
-            // 文件分片
-            file_handler->handle_recv(conn, file_chunk);
-        } else { // 剩下的不用服务器收
-            log_error("Unknown payload type");
-            continue;
+
+        if (!handle_frame(conn, frame)) {
+            return; // 转交出去了, 由那边接着读
         }
     }
     //log_debug("Attempting to re-add read event for fd: {}", conn->socket->get_fd());
@@ -145,6 +302,16 @@ void Dispatcher::dispatch_recv(TcpServerConnection* conn) {
         return;
     }
 
+    // 发送队列积压过多, 先不读了, 等flush()降到低水位后再挂回读事件
+    if (conn->write_queue.above_high()) {
+        conn->read_paused = true;
+        bool expected = true;
+        if (!conn->write_queue.below_low() || !conn->read_paused.compare_exchange_strong(expected, false)) {
+            log_info("Read paused for fd {} ({} bytes queued)", conn->socket->get_fd(), conn->write_queue.bytes());
+            return;
+        }
+    }
+
     //log_debug("read_event is valid, calling add_to_reactor()");
     try {
         conn->read_event->add_to_reactor();
@@ -167,36 +334,22 @@ void Dispatcher::dispatch_send(TcpServerConnection* conn) {
             break;
         }
         case DataType::FileChunk: {
-            // 不知道
+            file_handler->handle_send(conn);
             break;
         }
         case DataType::SyncItem: {
+            sync_handler->handle_send(conn);
             break;
         }
         case DataType::OfflineMessages: {
+            offline_message_handler->handle_send(conn);
             break;
         }
         default: {
-            std::cerr << "Unknown data type for sending\n";
-            return;
+            // 发送队列不分类型, 照样写出
+            conn->flush();
+            break;
         }
     }
-
-    // 统一处理：发送完成后, 重新添加读事件以继续接收数据
-    //log_debug("dispatch_send: Attempting to re-add read event for fd: {}", conn->socket->get_fd());
-
-    if (!conn->read_event) {
-        log_error("dispatch_send: CRITICAL: conn->read_event is null for fd: {}", conn->socket->get_fd());
-        return;
-    }
-
-    //log_debug("dispatch_send: read_event is valid, calling add_to_reactor()");
-    try {
-        conn->read_event->add_to_reactor();
-        //log_debug("dispatch_send: Read event re-added/modified in reactor (fd:{})", conn->read_event->get_sockfd());
-    } catch (const std::exception& e) {
-        log_error("dispatch_send: Exception in add_to_reactor() for fd {}: {}", conn->socket->get_fd(), e.what());
-    } catch (...) {
-        log_error("dispatch_send: Unknown exception in add_to_reactor() for fd {}", conn->socket->get_fd());
-    }
-}
\ No newline at end of file
+    // 读事件由dispatch_recv自己重新布防, 这里不碰, 免得同一连接被两个线程同时读
+}
@@ -7,9 +7,13 @@
 #include "../include/connection_manager.hpp"
 #include <iostream>
 #include <regex>
+#include <algorithm>
+#include <mutex>
+#include <cstdlib>
 #include "../include/sfile_manager.hpp"
 #include "../../global/include/time_utils.hpp"
 #include "../../global/abstract/datatypes_hash.hpp"
+#include "../../global/abstract/wire_codec.hpp"
 
 void try_send(ConnectionManager* conn_manager,
     TcpServerConnection* conn,
@@ -20,88 +24,217 @@ void try_send(ConnectionManager* conn_manager,
         log_info("try_send called with null connection, skip sending");
         return;
     }
-    // 首先设置要发送的数据
-    conn->socket->set_write_buf(proto);
     conn->set_send_type(type);
 
-    // 先尝试立即发送数据
-    ssize_t sent = conn->socket->send_with_size();
-    if (sent == 0) {
-        // 可能是缓冲区空或者socket不可写, 注册写事件等待
-        //log_debug("Socket not ready for writing or no data, registering write event for fd: {}", conn->socket->get_fd());
-        conn->write_event->add_to_reactor();
-    } else if (sent > 0) {
-        // 数据发送成功
-        if (!conn->user_ID.empty())
-            conn_manager->update_user_activity(conn->user_ID);
-        else
-            conn_manager->update_user_activity(conn->temp_user_ID);
-        log_debug("Sent immediately to fd={}, bytes={}, user_ID={}", conn->socket->get_fd(), sent, conn->user_ID);
+    // 按对端协商的能力调整帧: 不认v2就转回v1(只换头, 不重新解析),
+    // 能解压缩就把大帧压一下, 不能解的把已压缩的帧解开
+    std::string frame;
+    if (!conn->wire_v2) {
+        frame = wire::to_legacy(proto);
+    } else if (conn->wire_zstd) {
+        frame = conn->codec.compress(proto);
+    } else if (wire::is_compressed(proto)) {
+        conn->codec.decompress(proto, frame);
     } else {
-        // 发送出错 (sent < 0)
-        log_error("Failed to send (fd:{}): {}", conn->socket->get_fd(), strerror(errno));
+        frame = proto;
     }
+    if (frame.empty()) {
+        log_error("Failed to adapt frame for fd {}", conn->socket->get_fd());
+        return;
+    }
+    // 入队即返回, 能写多少先写多少, 剩下的等EPOLLOUT
+    if (!conn->send_frame(std::move(frame), TcpServerConnection::channel_of(type))) {
+        log_error("Failed to queue frame (fd:{}), connection is closing", conn->socket->get_fd());
+        return;
+    }
+    if (!conn->user_ID.empty())
+        conn_manager->update_user_activity(conn->user_ID);
+    else
+        conn_manager->update_user_activity(conn->temp_user_ID);
+    log_debug("Queued to fd={}, bytes={}, user_ID={}", conn->socket->get_fd(), proto.size(), conn->user_ID);
+}
+
+namespace {
+    constexpr size_t FANOUT_SLICE = 128;      // 一片多少个连接
+    constexpr size_t FANOUT_MAX_HELPERS = 7;  // 最多叫几个worker帮忙
+
+    // 一帧按对端能力最多三种形态, 用到哪种才编哪种, 编一次大家共用
+    class shared_frames {
+    public:
+        // packed是调用方已经压好的形态(没有就空着), zstd对端直接用, 不再压一次
+        shared_frames(std::string proto, std::string packed)
+            : proto(std::make_shared<const std::string>(std::move(proto))), has_packed(wire::is_compressed(packed)) {
+            if (has_packed) {
+                zstd = std::make_shared<const std::string>(std::move(packed));
+            }
+        }
+
+        // 和try_send的适配规则一致, 失败返回空
+        std::shared_ptr<const std::string> for_conn(TcpServerConnection* conn) {
+            if (!conn->wire_v2) {
+                return build(legacy_once, legacy, [this] { return wire::to_legacy(*proto); });
+            }
+            if (conn->wire_zstd) {
+                if (wire::is_compressed(*proto) || proto->size() < wire::COMPRESS_MIN) {
+                    return proto;
+                }
+                if (has_packed) {
+                    return zstd;
+                }
+                return build(zstd_once, zstd, [this] { return wire::codec::local().compress(*proto); });
+            }
+            if (!wire::is_compressed(*proto)) {
+                return proto;
+            }
+            return build(plain_once, plain, [this] {
+                std::string out;
+                wire::codec::local().decompress(*proto, out);
+                return out;
+            });
+        }
+
+    private:
+        template<typename F>
+        std::shared_ptr<const std::string> build(std::once_flag& once, std::shared_ptr<const std::string>& out, F make) {
+            std::call_once(once, [&] {
+                std::string frame = make();
+                if (!frame.empty()) {
+                    out = std::make_shared<const std::string>(std::move(frame));
+                }
+            });
+            return out;
+        }
+
+        std::shared_ptr<const std::string> proto;
+        const bool has_packed; // zstd构造时就有了, 之后只读
+        std::shared_ptr<const std::string> legacy, zstd, plain;
+        std::once_flag legacy_once, zstd_once, plain_once;
+    };
+
+    // 切片由调用线程和帮忙的worker抢着做; 帮手可能在调用方返回后才开始, 所以整个放在shared_ptr里
+    struct fanout_job {
+        ConnectionManager* conn_manager;
+        std::vector<TcpServerConnection*> conns;
+        shared_frames frames;
+        DataType type;
+        size_t slices;
+        std::atomic<size_t> next{0};
+        std::atomic<size_t> done{0};
+
+        fanout_job(ConnectionManager* cm, std::vector<TcpServerConnection*> conns, std::string proto, DataType type,
+                   std::string packed)
+            : conn_manager(cm), conns(std::move(conns)), frames(std::move(proto), std::move(packed)), type(type),
+              slices((this->conns.size() + FANOUT_SLICE - 1) / FANOUT_SLICE) {}
+
+        void run() {
+            size_t s;
+            while ((s = next.fetch_add(1, std::memory_order_relaxed)) < slices) {
+                size_t end = std::min(conns.size(), (s + 1) * FANOUT_SLICE);
+                for (size_t i = s * FANOUT_SLICE; i < end; ++i) {
+                    send_one(conns[i]);
+                }
+                done.fetch_add(1, std::memory_order_release);
+            }
+        }
+
+        void send_one(TcpServerConnection* conn) {
+            conn->set_send_type(type);
+            auto frame = frames.for_conn(conn);
+            if (!frame) {
+                log_error("Failed to adapt frame for fd {}", conn->socket->get_fd());
+                return;
+            }
+            if (!conn->send_shared_frame(std::move(frame), TcpServerConnection::channel_of(type))) {
+                log_error("Failed to queue frame (fd:{}), connection is closing", conn->socket->get_fd());
+                return;
+            }
+            if (!conn->user_ID.empty())
+                conn_manager->update_user_activity(conn->user_ID);
+            else
+                conn_manager->update_user_activity(conn->temp_user_ID);
+        }
+    };
+}
+
+void fanout_send(ConnectionManager* conn_manager,
+    std::vector<TcpServerConnection*> conns,
+    std::string proto,
+    DataType type,
+    std::string packed
+) {
+    if (conns.empty()) {
+        return;
+    }
+    size_t count = conns.size();
+    size_t bytes = proto.size();
+    auto job = std::make_shared<fanout_job>(conn_manager, std::move(conns), std::move(proto), type, std::move(packed));
+    // 不在线程池里(或者只有一片)就自己发完
+    if (thread_pool* pool = thread_pool::current()) {
+        size_t helpers = std::min(job->slices - 1, FANOUT_MAX_HELPERS);
+        for (size_t i = 0; i < helpers; ++i) {
+            pool->post([job]() {
+                job->run();
+            }, thread_pool::current_priority());
+        }
+    }
+    job->run();
+    // 剩下的是帮手已经拿走、正在发的片, 等它们发完; 同一发送者的下一条消息不会抢到前面
+    while (job->done.load(std::memory_order_acquire) < job->slices) {
+        std::this_thread::yield();
+    }
+    log_debug("Fanout queued to {} connections, bytes={}", count, bytes);
 }
 
 /* Handler base */
 Handler::Handler(Dispatcher* dispatcher) : disp(dispatcher) {}
 
+thread_pool* Handler::blocking_pool() const {
+    return disp->get_blocking_pool();
+}
+
 /* ---------- MessageHandler ---------- */
 
 MessageHandler::MessageHandler(Dispatcher* dispatcher) : Handler(dispatcher) {}
 
-void MessageHandler::handle_recv(const ChatMessage& message, const std::string& ostr) {
-    std::string sender = message.sender();
-    std::string receiver = message.receiver();
-    bool is_group = message.is_group();
+void MessageHandler::handle_recv(const wire::chat_view& message, std::string_view raw) {
+    // redis里缓存压缩后的; 发给对端时只有协商了zstd的用这份, 其余的发原帧, 不用先压再解
+    std::string ostr = wire::codec::local().compress(raw);
+    std::string sender(message.sender);
+    std::string receiver(message.receiver);
+    bool is_group = message.is_group;
 
     if (!is_group) {
-        // 判断是不是他好友
-        if (disp->redis_con->is_friend(sender, receiver)) {
-            // 判断有没有被对方屏蔽
-            if (!disp->redis_con->is_blocked_by_friend(sender, receiver)) {
-                // 判断是否在线
-                if (disp->redis_con->get_user_status(receiver).first) {
-                    auto conn = disp->conn_manager->get_connection(receiver);
-                    if (conn) {
-                        // 在线, 直接发送
-                        try_send(disp->conn_manager, conn, ostr);
-                    }
+        std::string conv;
+        conv += std::min(sender, receiver);
+        conv += '.'; // 使用.分隔,无害
+        conv += std::max(sender, receiver);
+        // 是不是好友、有没有被对方屏蔽、对方在不在线, 连同缓存到redis, 一次往返做完
+        auto verdict = disp->redis_con->check_and_cache_private_message(
+            sender, receiver, ostr, conv, message.timestamp);
+        if (verdict == RedisController::PrivateVerdict::Online) {
+            auto conn = disp->conn_manager->get_connection(receiver);
+            if (conn) {
+                // 在线, 直接发送
+                if (conn->wire_v2 && conn->wire_zstd) {
+                    try_send(disp->conn_manager, conn, ostr, DataType::Message);
+                } else {
+                    try_send(disp->conn_manager, conn, std::string(raw), DataType::Message);
                 }
-                // 不在线
-            } else {
-                // 被屏蔽了
-                return;
             }
-        } else {
-            return;
         }
+        // 不在线的已经缓存了; 不是好友或者被屏蔽了就丢掉
+        return;
     } else { // 群组消息
-        // 判断他在不在群里
-        if (disp->redis_con->is_group_member(receiver, sender)) {
-            // 在群里, 对所有人发送
-            auto members = disp->redis_con->
-                get_group_members(receiver);
-            for (const auto& member_id : members) {
-                if (member_id == sender) continue; // 不发给自己
-                auto conn = disp->conn_manager->get_connection(member_id);
-                if (conn) {
-                    try_send(disp->conn_manager, conn, ostr);
-                }
-                // 离线
-            }
+        // 判断他在不在群里, 名单是进程内缓存的那份, 有序且不拷贝
+        auto members = disp->redis_con->get_group_members_shared(receiver);
+        if (std::binary_search(members->begin(), members->end(), sender)) {
+            // 在群里, 对所有在线的人发送(不发给自己), 离线的等上线拉取
+            fanout_send(disp->conn_manager,
+                disp->conn_manager->get_connections(*members, 0, sender), std::string(raw), DataType::Message, ostr);
         }
     }
     // 缓存到redis
-    std::string conv;
-    if (message.is_group()) {
-        conv = message.receiver();
-    } else {
-        conv += std::min(sender, receiver);
-        conv += '.'; // 使用.分隔,无害
-        conv += std::max(sender, receiver);
-    }
-    disp->redis_con->cache_chat_message(ostr, conv, message.timestamp());
+    disp->redis_con->cache_chat_message(ostr, receiver, message.timestamp);
     // // 存起来
     // disp->mysql_con->add_chat_message(
     //     sender, receiver, message.is_group(), message.timestamp(),
@@ -111,7 +244,7 @@ void MessageHandler::handle_recv(const ChatMessage& message, const std::string&
 }
 
 void MessageHandler::handle_send(TcpServerConnection* conn) {
-    conn->socket->send_with_size();
+    conn->flush();
 }
 
 /* ---------- CommandHandler ---------- */
@@ -123,8 +256,8 @@ void CommandHandler::handle_recv(
     const CommandRequest& command,
     const std::string& ostr) {
     Action action = (Action)command.action();
-    std::string subj = command.sender();
-    auto args = command.args();
+    const std::string& subj = command.sender();
+    const auto& args = command.args();
 
     if (action == Action::HEARTBEAT) {
         // 专门的心跳包
@@ -133,10 +266,6 @@ void CommandHandler::handle_recv(
     }
 
     switch (action) {
-        case Action::Sign_In: {
-            handle_sign_in(conn, subj, args[0]);
-            break;
-        }
         case Action::Sign_Out: {
             handle_sign_out(subj);
             break;
@@ -247,8 +376,12 @@ void CommandHandler::handle_recv(
             handle_set_temp_connection(conn, subj, std::stoi(args[0]));
             break;
         }
-        case Action::Online_Init: {
-            handle_online_init(subj, conn);
+        case Action::Mux_Connection: {
+            handle_mux_connection(conn);
+            break;
+        }
+        case Action::Wire_Version: {
+            handle_wire_version(conn, args[0], args.size() > 1 ? args[1] : "", args.size() > 2 ? args[2] : "");
             break;
         }
         default: {
@@ -258,29 +391,51 @@ void CommandHandler::handle_recv(
     }
 }
 
+co_task<> CommandHandler::handle_recv_async(
+    TcpServerConnection* conn,
+    CommandRequest command,
+    std::string ostr) {
+    Action action = (Action)command.action();
+    switch (action) {
+        case Action::Sign_In: {
+            co_await handle_sign_in(conn, command.sender(), command.args(0));
+            break;
+        }
+        case Action::Online_Init: {
+            co_await handle_online_init(command.sender(), conn);
+            break;
+        }
+        default: {
+            handle_recv(conn, command, ostr);
+            break;
+        }
+    }
+}
+
 void CommandHandler::handle_send(TcpServerConnection* conn) {
-    auto sent = conn->socket->send_with_size();
-    conn->socket->send_with_size();
-    log_debug("CommandHandler::handle_send called, sent to fd={}, size={}, user_ID={}", conn->socket->get_fd(), sent, conn->user_ID);
+    conn->flush();
+    log_debug("CommandHandler::handle_send called, fd={}, queued={}, user_ID={}", conn->socket->get_fd(), conn->write_queue.bytes(), conn->user_ID);
 }
 
-void CommandHandler::handle_sign_in(
+co_task<> CommandHandler::handle_sign_in(
     TcpServerConnection* conn,
-    const std::string& subj,
-    const std::string& password_hash) {
+    std::string subj,
+    std::string password_hash) {
     log_debug("handle_sign_in called");
     // 判断subj是邮箱还是用户名
     const std::regex pattern(R"([a-zA-Z0-9._%+-]+@[a-zA-Z0-9.-]+\.[a-zA-Z]{2,})");
     bool is_email = std::regex_match(subj, pattern);
     std::string ret;
     bool res;
-    if (is_email) {
-        res = disp->mysql_con->check_user_pswd(subj, password_hash);
-        ret = disp->mysql_con->get_user_id_from_email(subj); // user_ID
-    } else {
-        ret = disp->mysql_con->get_user_email_from_id(subj); // email
-        res = disp->mysql_con->check_user_pswd(ret, password_hash);
-    }
+    co_await run_blocking(blocking_pool(), [&] {
+        if (is_email) {
+            res = disp->mysql_con->check_user_pswd(subj, password_hash);
+            ret = disp->mysql_con->get_user_id_from_email(subj); // user_ID
+        } else {
+            ret = disp->mysql_con->get_user_email_from_id(subj); // email
+            res = disp->mysql_con->check_user_pswd(ret, password_hash);
+        }
+    });
     auto user_ID = is_email ? ret : subj; // user_ID
     auto user_email = is_email ? subj : ret; // email
     std::string err_msg;
@@ -300,10 +455,12 @@ void CommandHandler::handle_sign_in(
         auto env_out = create_command_string(
             Action::Refuse_Login, "", {err_msg});
         try_send(disp->conn_manager, conn, env_out);
-        return;
+        co_return;
     }
     // 通知所有在线好友
-    auto friends = disp->mysql_con->get_friends_list(user_ID);
+    auto friends = co_await run_blocking(blocking_pool(), [&] {
+        return disp->mysql_con->get_friends_list(user_ID);
+    });
     for (const auto& friend_ID : friends) {
         if (!disp->redis_con->get_user_status(friend_ID).first)
             continue; // 不在线
@@ -393,8 +550,8 @@ void CommandHandler::handle_uncommon_disconnect(const std::string& user_ID) {
 void CommandHandler::handle_register(
     TcpServerConnection* conn,
     const std::string& email,
-    std::string& user_ID,
-    std::string& user_password) {
+    const std::string& user_ID,
+    const std::string& user_password) {
     log_debug("handle_register called");
     std::string err_msg;
     bool user_ID_exists = disp->mysql_con->do_user_id_exist(user_ID);
@@ -552,7 +709,7 @@ void CommandHandler::handle_send_veri_code(
             try_send(disp->conn_manager, conn, env_out);
             return;
         } else {
-            log_error("!!! 邮件发送失败: " + sender.get_error() + " !!!");
+            log_error("!!! 邮件发送失败: {} !!!", sender.get_error());
         }
         auto env_out = create_command_string(
             Action::Refuse_Post_Code, "", {"暂时无法使用验证服务"});
@@ -671,7 +828,7 @@ void CommandHandler::handle_refuse_group_request(
     // 通知申请人，自己被拒了
     auto new_person_conn = disp->conn_manager->get_connection(user_ID, 1);
     try_send(disp->conn_manager, new_person_conn, ref_str);
-    log_info(conn->user_ID + "拒绝让" + user_ID + "加入群组" + group_ID);
+    log_info("{}拒绝让{}加入群组{}", conn->user_ID, user_ID, group_ID);
 }
 
 void CommandHandler::handle_accept_group_request(
@@ -747,7 +904,7 @@ void CommandHandler::handle_accept_group_request(
                 try_send(disp->conn_manager, member_conn, acc_str);
             }
         }
-        log_info(conn->user_ID + "同意了让" + user_ID + "加入群组" + group_ID);
+        log_info("{}同意了让{}加入群组{}", conn->user_ID, user_ID, group_ID);
 
     } catch (const std::exception& e) {
         log_error("handle_accept_group_request异常: command_id={}, error={}", command_id, e.what());
@@ -919,17 +1076,8 @@ void CommandHandler::handle_leave_group(
 ) {
     // 通知所有人,除了跑的
     auto members = disp->redis_con->get_group_members(group_ID);
-    for (auto& member_ID : members) {
-        if (user_ID == member_ID) continue;
-        auto conn = disp->conn_manager->get_connection(member_ID, 1);
-        if (conn) {
-            try_send(
-                disp->conn_manager,
-                conn,
-                ostr
-            );
-        }
-    }
+    fanout_send(disp->conn_manager,
+        disp->conn_manager->get_connections(members, 1, user_ID), ostr, DataType::None);
     // 从redis删除
     // 如果该用户是管理员，先从管理员列表中移除
     if (disp->redis_con->is_group_admin(group_ID, user_ID)) {
@@ -964,13 +1112,9 @@ void CommandHandler::handle_disband_group(
     }
     // 通知所有人
     auto member_list = disp->redis_con->get_group_members(group_ID);
-    for (const auto& member_ID : member_list) {
-        if (member_ID == owner_ID) continue; // 不通知执行的
-        auto conn = disp->conn_manager->get_connection(member_ID, 1);
-        if (conn) {
-            try_send(disp->conn_manager, conn, ostr);
-        }
-    }
+    // 不通知执行的
+    fanout_send(disp->conn_manager,
+        disp->conn_manager->get_connections(member_list, 1, owner_ID), ostr, DataType::None);
     // 从redis删除
     for (auto& member_ID : member_list) {
         disp->redis_con->remove_user_from_group(member_ID, group_ID);
@@ -1252,7 +1396,14 @@ void CommandHandler::handle_remember_connection(
     // 将连接添加到连接管理器
     // 每次登录, 这个会调用三次
     conn->user_ID = user_ID; // 更新连接的user_ID
-    disp->conn_manager->add_conn(conn, server_index);
+    if (conn->mux) {
+        // 复用连接一次占满三个位置
+        for (int i = 0; i < 3; ++i) {
+            disp->conn_manager->add_conn(conn, i);
+        }
+    } else {
+        disp->conn_manager->add_conn(conn, server_index);
+    }
     log_info("Remembered {}'s conn[{}] fd: {}", user_ID, server_index, conn->socket->get_fd());
 }
 
@@ -1260,24 +1411,63 @@ void CommandHandler::handle_set_temp_connection(
         TcpServerConnection* conn, const std::string& temp_user_ID, int server_index) {
     log_info("handle_set_temp_connection called for temp_user_ID: {}, server_index: {}", temp_user_ID, server_index);
     conn->temp_user_ID = temp_user_ID;
-    disp->conn_manager->add_temp_conn(conn, server_index);
+    if (conn->mux) {
+        for (int i = 0; i < 3; ++i) {
+            disp->conn_manager->add_temp_conn(conn, i);
+        }
+    } else {
+        disp->conn_manager->add_temp_conn(conn, server_index);
+    }
     log_info("Set {}'s conn[{}] fd: {}", temp_user_ID, server_index, conn->socket->get_fd());
 }
 
-void CommandHandler::handle_online_init(const std::string& user_ID, TcpServerConnection* conn) {
+void CommandHandler::handle_mux_connection(TcpServerConnection* conn) {
+    // 这一帧之后收发都按复用格式, 同一连接的帧是顺序处理的, 直接切换即可
+    conn->mux = true;
+    log_info("Connection fd {} switched to multiplexed mode", conn->socket->get_fd());
+}
+
+void CommandHandler::handle_wire_version(
+    TcpServerConnection* conn,
+    const std::string& version,
+    const std::string& server_index,
+    const std::string& codecs) {
+    // 只认识v2, 更高的版本也按v2回, 客户端据此降级
+    if (std::atoi(version.c_str()) < 2) {
+        return;
+    }
+    conn->wire_v2 = true;
+    // 压缩只在v2帧上, 客户端列出且本端编译了才开
+    std::string codec;
+    if (wire::available() && codecs.find(wire::CODEC_NAME) != std::string::npos) {
+        codec = wire::CODEC_NAME;
+        conn->wire_zstd = true;
+    }
+    log_debug("Connection fd {} negotiated wire v2, codec: {}", conn->socket->get_fd(), codec.empty() ? "none" : codec);
+    // 只在命令连接上回应, 其他连接的读线程不收命令
+    if (server_index == "1") {
+        auto reply = create_command_string(Action::Wire_Version, "", {"2", server_index, codec});
+        try_send(disp->conn_manager, conn, reply);
+    }
+}
+
+co_task<> CommandHandler::handle_online_init(std::string user_ID, TcpServerConnection* conn) {
     log_debug("handle_online_init called for user: {}", user_ID);
-    disp->conn_manager->remove_user(conn->temp_user_ID);
     json relation_data; // 用于存储关系网数据
     json blocked_info;
-    get_relation_net(user_ID, relation_data);
-    get_blocked_info(user_ID, relation_data["friends"], blocked_info);
+    // 临时身份下线和整张关系网都要查库, 一次挂起做完
+    co_await run_blocking(blocking_pool(), [&] {
+        disp->conn_manager->remove_user(conn->temp_user_ID);
+        get_relation_net(user_ID, relation_data);
+        get_blocked_info(user_ID, relation_data["friends"], blocked_info);
+    });
     disp->redis_con->load_user_relations(user_ID, relation_data, blocked_info);
     // 发送最新关系网
     handle_post_relation_net(user_ID, relation_data);
     // 发送所有在线好友的状态
     handle_post_friends_status(user_ID, relation_data["friends"]);
     // 发送用户离线消息（消息记录）
-    handle_post_offline_messages(user_ID, relation_data);
+    co_await handle_post_offline_messages(user_ID, relation_data);
     // 发送未接收的通知和未处理的好友请求/群聊邀请等
     //handle_post_unordered_noti_and_req(user_ID, relation_data);
     /**
@@ -1314,7 +1504,7 @@ void CommandHandler::handle_post_friends_status(
     }
 }
 
-void CommandHandler::handle_post_offline_messages(const std::string& user_ID, const json& relation_data) {
+co_task<> CommandHandler::handle_post_offline_messages(std::string user_ID, const json& relation_data) {
     log_debug("handle_post_offline_messages called for user: {}", user_ID);
 
     try {
@@ -1326,7 +1516,9 @@ void CommandHandler::handle_post_offline_messages(const std::string& user_ID, co
         std::unordered_set<ChatMessage, std::hash<ChatMessage>, decltype(cmp)> chat_messages(10, std::hash<ChatMessage>(), cmp);
 
         // 获取用户的last_active时间
-        std::int64_t last_active = disp->mysql_con->get_user_last_active(user_ID);
+        std::int64_t last_active = co_await run_blocking(blocking_pool(), [&] {
+            return disp->mysql_con->get_user_last_active(user_ID);
+        });
         if (last_active == 0) {
             // 理论上是初次登录
             log_debug("No last_active time found for user {}, sending empty offline messages", user_ID);
@@ -1346,7 +1538,9 @@ void CommandHandler::handle_post_offline_messages(const std::string& user_ID, co
             }
 
             // 从MySQL获取离线消息（最多500条）
-            auto offline_msg_data = disp->mysql_con->get_offline_messages(user_ID, last_active, 500 - got_msg_cnt);
+            auto offline_msg_data = co_await run_blocking(blocking_pool(), [&] {
+                return disp->mysql_con->get_offline_messages(user_ID, last_active, 500 - got_msg_cnt);
+            });
 
             if (offline_msg_data.empty()) {
                 log_debug("No offline messages found for user: {}", user_ID);
@@ -1387,7 +1581,10 @@ void CommandHandler::handle_post_offline_messages(const std::string& user_ID, co
             log_info("Sent {} offline messages to user: {}", chat_messages.size(), user_ID);
             // 在成功发送离线消息后，更新 MySQL 中的 last_active，
             // 标记本次发送为新的离线查询起点，避免后续再次登录重复发送。
-            disp->mysql_con->update_user_last_active(user_ID);
+            co_await run_blocking(blocking_pool(), [&] {
+                disp->mysql_con->update_user_last_active(user_ID);
+            });
+            disp->conn_manager->persist_user_activity(user_ID);
         } else {
             log_error("Data connection not found for user: {}", user_ID);
         }
@@ -1509,9 +1706,8 @@ void FileHandler::handle_recv(
     const FileChunk& file_chunk) {
     // 获取文件指针
     auto file = disp->file_manager->upload_tasks[conn->user_ID].server_file;
-    // 写入数据
-    std::vector<char> data(file_chunk.data().begin(), file_chunk.data().end());
-    file->write_chunk(data, file_chunk.chunk_index());
+    // 写入数据, 直接从解析出来的分片写, 不再拷一份
+    file->write_chunk(file_chunk.data(), file_chunk.chunk_index());
     if (file->is_complete()) {
         bool success = file->finalize_upload();
         disp->file_manager->upload_tasks.erase(conn->user_ID);
@@ -1524,7 +1720,7 @@ void FileHandler::handle_recv(
 }
 
 void FileHandler::handle_send(TcpServerConnection* conn) {
-    conn->socket->send_with_size();
+    conn->flush();
     log_debug("FileHandler::handle_send called");
 }
 
@@ -1533,7 +1729,7 @@ void FileHandler::handle_send(TcpServerConnection* conn) {
 SyncHandler::SyncHandler(Dispatcher* dispatcher) : Handler(dispatcher) {}
 
 void SyncHandler::handle_send(TcpServerConnection* conn) {
-    conn->socket->send_with_size();
+    conn->flush();
     log_debug("SyncHandler::handle_send called");
 }
 
@@ -1542,6 +1738,6 @@ void SyncHandler::handle_send(TcpServerConnection* conn) {
 OfflineMessageHandler::OfflineMessageHandler(Dispatcher* dispatcher) : Handler(dispatcher) {}
 
 void OfflineMessageHandler::handle_send(TcpServerConnection* conn) {
-    conn->socket->send_with_size();
+    conn->flush();
     log_debug("OfflineMessageHandler::handle_send called");
 }
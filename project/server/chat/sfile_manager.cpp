@@ -4,7 +4,9 @@
 #include "../../global/include/logging.hpp"
 #include "../../global/include/threadpool.hpp"
 #include "../../global/abstract/datatypes.hpp"
+#include "../include/TcpServerConnection.hpp"
 #include <chrono>
+#include <algorithm>
 
 extern void try_send(ConnectionManager* conn_manager, TcpServerConnection* conn,
                     const std::string& proto, DataType type = DataType::Command);
@@ -30,9 +32,9 @@ void SFileManager::add_download_task(const std::string& user_id, const std::stri
     log_debug("Adding download task for user: {}, file_id: {}", user_id, file_id);
     // 直接提交单个任务到线程池处理
     if (pool) {
-        pool->submit([this, task]() {
+        pool->post([this, task = std::move(task)]() {
             this->process_single_download_task(task);
-        });
+        }, thread_pool::Priority::Bulk);
     } else {
         log_error("Thread pool not set for SFileManager");
     }
@@ -46,9 +48,9 @@ void SFileManager::add_upload_task(const std::string& user_id, ServerFilePtr ser
     log_debug("Adding upload task for user: {}, file: {}", user_id, server_file->file_name);
     // 直接提交单个任务到线程池处理
     if (pool) {
-        pool->submit([this, task]() {
+        pool->post([this, task = std::move(task)]() {
             this->process_single_upload_task(task);
-        });
+        }, thread_pool::Priority::Bulk);
     } else {
         log_error("Thread pool not set for SFileManager");
     }
@@ -64,6 +66,12 @@ void SFileManager::process_single_download_task(const FileDownloadTask& task) {
         task.file_size,
         storage
     );
+    if (raw_download) {
+        if (send_raw_chunks(task, server_file)) {
+            log_info("File download completed for user: {}, file: {}", task.user_id, task.file_name);
+        }
+        return;
+    }
     // 打开文件进行读取
     if (!server_file->open_for_read()) {
         log_error("Failed to open file for reading: {}", task.file_id);
@@ -82,12 +90,13 @@ void SFileManager::process_single_download_task(const FileDownloadTask& task) {
                 break;
             }
             bool is_last_chunk = (chunk_index == total_chunks - 1);
-            // 发送分片
-            send_file_chunk(task.user_id, task.file_id, chunk_data, chunk_index, total_chunks, is_last_chunk);
+            // 发送分片, 发送队列满时在里面等, 不再固定sleep
+            if (!send_file_chunk(task.user_id, task.file_id, chunk_data, chunk_index, total_chunks, is_last_chunk)) {
+                log_error("Abort download of {} at chunk {}", task.file_id, chunk_index);
+                return;
+            }
             log_debug("Sent chunk {}/{} for file: {} (size: {} bytes)",
                      chunk_index + 1, total_chunks, task.file_name, chunk_data.size());
-            // 添加小延迟避免网络拥塞
-            std::this_thread::sleep_for(std::chrono::milliseconds(5));
         } catch (const std::exception& e) {
             log_error("Error sending chunk {} for file {}: {}", chunk_index, task.file_id, e.what());
             break;
@@ -97,6 +106,42 @@ void SFileManager::process_single_download_task(const FileDownloadTask& task) {
     log_info("File download completed for user: {}, file: {}", task.user_id, task.file_name);
 }
 
+bool SFileManager::send_raw_chunks(const FileDownloadTask& task, const ServerFilePtr& server_file) {
+    auto file = shared_file::open(server_file->get_storage_path());
+    if (!file) {
+        log_error("Failed to open file for reading: {}", task.file_id);
+        return false;
+    }
+    size_t total_chunks = server_file->get_total_chunks();
+    log_info("Starting raw file download: {} ({} chunks)", task.file_name, total_chunks);
+    for (size_t chunk_index = 0; chunk_index < total_chunks; ++chunk_index) {
+        size_t offset = chunk_index * CHUNK_SIZE;
+        size_t len = std::min(CHUNK_SIZE, task.file_size - offset);
+        auto conn = disp->conn_manager->get_connection(task.user_id, 2);
+        if (!conn) {
+            log_error("Data connection not found for user: {}", task.user_id);
+            return false;
+        }
+        // 背压: 队列超过高水位就等它降到低水位
+        if (!conn->wait_writable(std::chrono::seconds(30))) {
+            log_error("Data connection of user {} is not draining, give up", task.user_id);
+            return false;
+        }
+        // 只拼帧头, 客户端按普通FileChunk解析, 不需要知道数据是sendfile来的
+        auto head = create_file_chunk_head(task.file_id, len, chunk_index, total_chunks,
+                                           chunk_index == total_chunks - 1, conn->wire_v2 ? 2 : 1);
+        conn->set_send_type(DataType::FileChunk);
+        if (!conn->send_file_frame(std::move(head), file, static_cast<off_t>(offset), len,
+                                   TcpServerConnection::channel_of(DataType::FileChunk))) {
+            log_error("Abort download of {} at chunk {}", task.file_id, chunk_index);
+            return false;
+        }
+        log_debug("Queued raw chunk {}/{} for file: {} (size: {} bytes)",
+                  chunk_index + 1, total_chunks, task.file_name, len);
+    }
+    return true;
+}
+
 void SFileManager::process_single_upload_task(const FileUploadTask& task) {
     log_debug("Processing upload task for user: {}, file: {}", task.user_id, task.server_file->file_name);
 
@@ -116,7 +161,7 @@ void SFileManager::process_single_upload_task(const FileUploadTask& task) {
     }
 }
 
-void SFileManager::send_file_chunk(const std::string& user_id, const std::string& file_id,
+bool SFileManager::send_file_chunk(const std::string& user_id, const std::string& file_id,
                                   const std::vector<char>& chunk_data, size_t chunk_index,
                                   size_t total_chunks, bool is_last_chunk) {
     auto chunk = create_file_chunk_string(
@@ -124,13 +169,18 @@ void SFileManager::send_file_chunk(const std::string& user_id, const std::string
         total_chunks, is_last_chunk);
     if (chunk.empty()) {
         log_error("Failed to create file chunk string for file_id: {}, chunk_index: {}", file_id, chunk_index);
-        return;
+        return false;
     }
     auto conn = disp->conn_manager->get_connection(user_id, 2);
     if (!conn) {
         log_error("Data connection not found for user: {}", user_id);
-        return;
+        return false;
+    }
+    // 背压: 队列超过高水位就等它降到低水位
+    if (!conn->wait_writable(std::chrono::seconds(30))) {
+        log_error("Data connection of user {} is not draining, give up", user_id);
+        return false;
     }
     try_send(disp->conn_manager, conn, chunk, DataType::FileChunk);
+    return true;
 }
-
@@ -0,0 +1,53 @@
+#include "../include/group_cache.hpp"
+#include <algorithm>
+#include <mutex>
+
+GroupMemberCache::shard& GroupMemberCache::shard_of(const std::string& group_ID) {
+    return shards[std::hash<std::string>{}(group_ID) % SHARD_NUM];
+}
+
+GroupMemberCache::members_ptr GroupMemberCache::members(const std::string& group_ID) {
+    shard& sh = shard_of(group_ID);
+    uint64_t generation;
+    {
+        std::shared_lock<std::shared_mutex> lock(sh.m_Mutex);
+        auto it = sh.groups.find(group_ID);
+        if (it != sh.groups.end()) {
+            return it->second;
+        }
+        generation = sh.generation;
+    }
+    // 不持锁装载, 同一个群可能有几个线程同时装, 最后只留一份
+    auto list = load(group_ID);
+    std::sort(list.begin(), list.end());
+    bool empty = list.empty();
+    members_ptr loaded = std::make_shared<const std::vector<std::string>>(std::move(list));
+    if (empty) {
+        return loaded; // 没有这个群(或者刚建还没写进去), 不缓存, 免得随便一个群号都常驻内存
+    }
+    std::unique_lock<std::shared_mutex> lock(sh.m_Mutex);
+    if (sh.generation != generation) {
+        return loaded; // 装载期间有过变动, 这份只给本次用
+    }
+    return sh.groups.emplace(group_ID, std::move(loaded)).first->second;
+}
+
+bool GroupMemberCache::is_member(const std::string& group_ID, const std::string& user_ID) {
+    auto list = members(group_ID);
+    return std::binary_search(list->begin(), list->end(), user_ID);
+}
+
+void GroupMemberCache::invalidate(const std::string& group_ID) {
+    shard& sh = shard_of(group_ID);
+    std::unique_lock<std::shared_mutex> lock(sh.m_Mutex);
+    sh.groups.erase(group_ID);
+    ++sh.generation;
+}
+
+void GroupMemberCache::clear() {
+    for (auto& sh : shards) {
+        std::unique_lock<std::shared_mutex> lock(sh.m_Mutex);
+        sh.groups.clear();
+        ++sh.generation;
+    }
+}
@@ -22,7 +22,7 @@ bool MySQLController::connect() {
 
     if (!mysql_real_connect(conn, host.c_str(), user.c_str(), password.c_str(),
                             dbname.c_str(), port, nullptr, 0)) {
-        log_error("MySQL connection failed: " + std::string(mysql_error(conn)));
+        log_error("MySQL connection failed: {}", mysql_error(conn));
         return false;
     }
     return true;
@@ -137,12 +137,36 @@ bool MySQLController::check_user_pswd(const std::string& email, const std::strin
     return exists;
 }
 
-void MySQLController::update_user_last_active(const std::string& email) {
-    std::string sql = "UPDATE users SET last_active = NOW(6) WHERE user_email = '"
-        + normalize_email(email) + "';";
+void MySQLController::update_user_last_active(const std::string& user_ID) {
+    std::string sql = "UPDATE users SET last_active = NOW(6) WHERE user_id = '" + user_ID + "';";
     execute(sql);
 }
 
+bool MySQLController::update_users_last_active(const std::vector<std::pair<std::string, std::int64_t>>& users) {
+    constexpr size_t ACTIVE_BATCH = 500;
+    bool ok = true;
+    for (size_t begin = 0; begin < users.size(); begin += ACTIVE_BATCH) {
+        size_t end = std::min(users.size(), begin + ACTIVE_BATCH);
+        std::string cases, ids;
+        for (size_t i = begin; i < end; ++i) {
+            const auto& [user_ID, last_active] = users[i];
+            // 微秒拆成秒和小数部分, 和NOW(6)的精度一致
+            std::string frac = std::to_string(last_active % 1000000);
+            frac.insert(0, 6 - frac.size(), '0');
+            cases += " WHEN '" + user_ID + "' THEN FROM_UNIXTIME("
+                + std::to_string(last_active / 1000000) + "." + frac + ")";
+            if (i != begin) {
+                ids += ", ";
+            }
+            ids += "'" + user_ID + "'";
+        }
+        std::string sql = "UPDATE users SET last_active = CASE user_id" + cases
+            + " ELSE last_active END WHERE user_id IN (" + ids + ");";
+        ok = execute(sql) && ok;
+    }
+    return ok;
+}
+
 std::string MySQLController::get_user_id_from_email(const std::string& email) {
     std::string sql = "SELECT user_id FROM users WHERE user_email = '"
         + normalize_email(email) + "';";
@@ -3,10 +3,98 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <iterator>
+#include <random>
+#include <unistd.h>
 #include "../../global/include/time_utils.hpp"
 
+namespace {
+    const std::string GROUP_INVALIDATE_CHANNEL = "chat:group:invalidate";
+
+    // KEYS: 发送者好友表, 接收者在线状态, 会话消息zset
+    // ARGV: 接收者ID, 消息, 时间戳
+    // 好友表里没有接收者 -> 0, 值为"1"(被屏蔽) -> 1, 否则写入消息后按在线状态返回2/3
+    const std::string PRIVATE_MSG_SCRIPT = R"(
+local blocked = redis.call('HGET', KEYS[1], ARGV[1])
+if not blocked then return 0 end
+if blocked == '1' then return 1 end
+redis.call('ZADD', KEYS[3], ARGV[3], ARGV[2])
+local status = redis.call('GET', KEYS[2])
+if status and cjson.decode(status)['online'] == true then return 3 end
+return 2
+)";
+
+    // KEYS: 各用户的在线状态, ARGV: 对应的新值
+    // 只覆盖仍是在线的; 已经写成离线(或临时用户已删掉)的不动, 刷写慢了也不会把下线的人写回在线
+    const std::string USERS_ACTIVE_SCRIPT = R"(
+for i, key in ipairs(KEYS) do
+    local status = redis.call('GET', key)
+    if status and cjson.decode(status)['online'] == true then
+        redis.call('SET', key, ARGV[i])
+    end
+end
+return 0
+)";
+}
+
 RedisController::RedisController()
-    : redis_conn("tcp://127.0.0.1:6379") {}
+    : redis_conn("tcp://127.0.0.1:6379"),
+      group_cache([this](const std::string& group_ID) {
+          // Redis不留空集合, 键不存在时SMEMBERS就是空的, 缓存那边据此不存
+          std::vector<std::string> members;
+          redis_conn.smembers("chat:group:" + group_ID + ":members", std::back_inserter(members));
+          return members;
+      }) {
+    instance_ID = std::to_string(std::random_device{}()) + "-" + std::to_string(::getpid());
+    invalidation_thread = std::thread(&RedisController::listen_invalidations, this);
+}
+
+RedisController::~RedisController() {
+    running = false;
+    if (invalidation_thread.joinable()) {
+        invalidation_thread.join(); // 订阅连接有读超时, 最多等一个超时周期
+    }
+}
+
+void RedisController::invalidate_group(const std::string& group_ID) {
+    group_cache.invalidate(group_ID);
+    try {
+        redis_conn.publish(GROUP_INVALIDATE_CHANNEL, instance_ID + " " + group_ID);
+    } catch (const std::exception& e) {
+        log_error("Failed to publish invalidation of group {}: {}", group_ID, e.what());
+    }
+}
+
+void RedisController::listen_invalidations() {
+    sw::redis::ConnectionOptions opts;
+    opts.host = "127.0.0.1";
+    opts.port = 6379;
+    opts.socket_timeout = std::chrono::milliseconds(1000); // consume()定期返回, 好检查running
+    while (running) {
+        try {
+            Redis sub_redis(opts);
+            auto sub = sub_redis.subscriber();
+            sub.on_message([this](std::string, std::string msg) {
+                auto sep = msg.find(' ');
+                if (sep == std::string::npos || msg.compare(0, sep, instance_ID) == 0) {
+                    return; // 自己发的, 本地早就作废了
+                }
+                group_cache.invalidate(msg.substr(sep + 1));
+            });
+            sub.subscribe(GROUP_INVALIDATE_CHANNEL);
+            group_cache.clear();
+            while (running) {
+                try {
+                    sub.consume();
+                } catch (const sw::redis::TimeoutError&) {
+                    continue;
+                }
+            }
+        } catch (const std::exception& e) {
+            log_error("Group invalidation subscriber failed: {}, reconnecting", e.what());
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
+    }
+}
 
 bool RedisController::cache_chat_message(
     const std::string& serialized_msg,
@@ -24,6 +112,48 @@ bool RedisController::cache_chat_message(
     }
 }
 
+RedisController::PrivateVerdict RedisController::check_and_cache_private_message(
+    const std::string& sender,
+    const std::string& receiver,
+    const std::string& serialized_msg,
+    const std::string& conv,
+    int64_t timestamp
+) {
+    std::vector<std::string> keys = {
+        "chat:user:" + sender + ":friends",
+        "chat:user:" + receiver + ":status",
+        "chat:messages:" + conv
+    };
+    std::vector<std::string> args = {receiver, serialized_msg, std::to_string(timestamp)};
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        std::string sha;
+        {
+            std::lock_guard<std::mutex> lock(script_mutex);
+            if (private_msg_sha.empty() || attempt > 0) {
+                try {
+                    private_msg_sha = redis_conn.script_load(PRIVATE_MSG_SCRIPT);
+                } catch (const sw::redis::Error& err) {
+                    log_error("Failed to load private message script: {}", err.what());
+                    return PrivateVerdict::Error;
+                }
+            }
+            sha = private_msg_sha;
+        }
+        try {
+            auto verdict = redis_conn.evalsha<long long>(sha, keys.begin(), keys.end(), args.begin(), args.end());
+            return static_cast<PrivateVerdict>(verdict);
+        } catch (const sw::redis::Error& err) {
+            // Redis重启或SCRIPT FLUSH后脚本没了, 重新加载再试一次
+            if (std::string_view(err.what()).substr(0, 8) == "NOSCRIPT") {
+                continue;
+            }
+            log_error("Failed to check private message {} -> {}: {}", sender, receiver, err.what());
+            return PrivateVerdict::Error;
+        }
+    }
+    return PrivateVerdict::Error;
+}
+
 std::vector<std::string> RedisController::pop_chat_messages_batch(size_t count) {
     std::vector<std::string> messages;
     try {
@@ -99,6 +229,23 @@ void RedisController::set_user_status(const std::string& user_ID, bool online) {
     redis_conn.set(key, jval.dump());
 }
 
+void RedisController::set_users_active(const std::vector<std::pair<std::string, std::int64_t>>& users) {
+    std::vector<std::string> keys;
+    std::vector<std::string> vals;
+    keys.reserve(users.size());
+    vals.reserve(users.size());
+    for (const auto& [user_ID, last_active] : users) {
+        json jval = {
+            {"online", true},
+            {"last_active", last_active}
+        };
+        keys.push_back("chat:user:" + user_ID + ":status");
+        vals.push_back(jval.dump());
+    }
+    // 几秒才刷一次, 直接带脚本原文, 不用像私聊那样缓存SHA
+    redis_conn.eval<long long>(USERS_ACTIVE_SCRIPT, keys.begin(), keys.end(), vals.begin(), vals.end());
+}
+
 void RedisController::del_user_status(const std::string& user_ID) {
     auto key = "chat:user:" + user_ID + ":status";
     redis_conn.del(key);
@@ -401,6 +548,7 @@ bool RedisController::cache_group_members(const std::string& group_ID, const std
             }
         }
 
+        invalidate_group(group_ID);
         // 群组信息持久化, 不设置过期时间
         log_debug("Cached {} members for group {}", members.size(), group_ID);
         return true;
@@ -461,6 +609,7 @@ bool RedisController::add_group_member(const std::string& group_ID, const std::s
 
         // 添加到成员集合
         redis_conn.sadd(members_key, user_ID);
+        invalidate_group(group_ID);
 
         // 更新成员数量
         redis_conn.hincrby(info_key, "member_count", 1);
@@ -485,6 +634,7 @@ bool RedisController::remove_group_member(const std::string& group_ID, const std
 
         // 从成员集合中移除
         redis_conn.srem(members_key, user_ID);
+        invalidate_group(group_ID);
 
         // 从管理员集合中移除（如果是管理员）
         redis_conn.srem(admins_key, user_ID);
@@ -539,6 +689,7 @@ bool RedisController::remove_group(const std::string& group_ID) {
         for (const auto& key : keys_to_delete) {
             redis_conn.del(key);
         }
+        invalidate_group(group_ID);
 
         log_info("Removed group {} from cache", group_ID);
         return true;
@@ -550,8 +701,7 @@ bool RedisController::remove_group(const std::string& group_ID) {
 
 bool RedisController::is_group_member(const std::string& group_ID, const std::string& user_ID) {
     try {
-        std::string key = "chat:group:" + group_ID + ":members";
-        return redis_conn.sismember(key, user_ID);
+        return group_cache.is_member(group_ID, user_ID);
     } catch (const std::exception& e) {
         log_error("Failed to check if user {} is member of group {}: {}", user_ID, group_ID, e.what());
         return false;
@@ -569,16 +719,15 @@ bool RedisController::is_group_admin(const std::string& group_ID, const std::str
 }
 
 std::vector<std::string> RedisController::get_group_members(const std::string& group_ID) {
-    try {
-        std::string key = "chat:group:" + group_ID + ":members";
-        std::unordered_set<std::string> members_set;
-        redis_conn.smembers(key, std::inserter(members_set, members_set.begin()));
+    return *get_group_members_shared(group_ID);
+}
 
-        std::vector<std::string> members(members_set.begin(), members_set.end());
-        return members;
+GroupMemberCache::members_ptr RedisController::get_group_members_shared(const std::string& group_ID) {
+    try {
+        return group_cache.members(group_ID);
     } catch (const std::exception& e) {
         log_error("Failed to get members of group {}: {}", group_ID, e.what());
-        return {};
+        return std::make_shared<const std::vector<std::string>>();
     }
 }
 
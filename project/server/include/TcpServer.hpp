@@ -3,6 +3,9 @@
 #include "../../global/include/threadpool.hpp"
 #include "../../global/include/command.hpp"
 #include <functional>
+#include <vector>
+#include <thread>
+#include <atomic>
 #include "TcpServerConnection.hpp"
 
 class Dispatcher;
@@ -12,14 +15,22 @@ class ListenSocket;
 namespace set_addr_s {
     using Addr = std::pair<std::string, uint16_t>;
     extern Addr server_addr[3];
+    extern int loop_num; // 每个逻辑服务器的reactor数量
 }
 
 class TcpServer {
 private:
-    reactor* pr = nullptr; // 反应堆, 事件丢到这里
-    ListenSocket* listen_conn = nullptr; // 监听套接字
+    // 每个reactor配一个监听套接字, 多个时用SO_REUSEPORT让内核分流
+    // 连接一直留在接受它的reactor上
+    std::vector<reactor*> reactors;
+    std::vector<ListenSocket*> listen_conns;
+    std::vector<std::thread> loop_threads;
     thread_pool* pool = nullptr; // (外援)线程池, 事件回调丢这里
-    bool running = false;
+    // 事件回调的优先级: 命令服务器Critical, 消息服务器Normal, 数据服务器Bulk
+    thread_pool::Priority task_pri = thread_pool::Priority::Normal;
+    std::atomic<bool> running = false;
+
+    void loop(int loop_idx);
 
 public:
     friend class Dispatcher;
@@ -27,17 +38,22 @@ public:
     Dispatcher* disp = nullptr; // 分发器, 事件分发到这里
     int idx;
 
-    TcpServer(int idx);
+    TcpServer(int idx, int loop_num = 1);
     TcpServer(int idx, const std::string& ip, uint16_t port);
     ~TcpServer();
 
     // 获取fd
-    int get_lfd() const;
-    int get_efd() const;
+    int get_lfd(int loop_idx = 0) const;
+    int get_efd(int loop_idx = 0) const;
+    int get_loop_num() const;
 
     // 配置和初始化
     void init(thread_pool* pool, Dispatcher* disp);
+    // 连接读写事件的优先级; 复用连接三个通道共用一条连接, 按Normal投递, 包拼好后再按通道换
+    thread_pool::Priority priority_of(const TcpServerConnection* conn) const;
+    // 每个reactor开一个专用线程跑主循环, 立即返回; 多reactor时线程绑核
     void start();
     void stop();
-    void auto_accept();
+    // reactor线程: 接受到EAGAIN为止(单次有上限, 超出部分投递到下一轮), 批量注册
+    void auto_accept(int loop_idx = 0);
 };
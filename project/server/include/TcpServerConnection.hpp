@@ -1,9 +1,13 @@
 #pragma once
 
 #include "../../global/abstract/datatypes.hpp"
-#include "../../global/include/safe_queue.hpp"
+#include "../../io/include/outbound_queue.hpp"
+#include "../../io/include/timing_wheel.hpp"
+#include "../../io/include/mux_frame.hpp"
+#include "../../global/abstract/wire_codec.hpp"
 #include <string>
 #include <atomic>
+#include <chrono>
 
 class event;
 class reactor;
@@ -25,21 +29,80 @@ enum class ReceiveStatus {
 };
 
 class TcpServerConnection : public std::enable_shared_from_this<TcpServerConnection> {
+private:
+    // 空闲检测: 收到数据只更新时间戳, 定时器到点再比较, 不用挪定时器
+    std::atomic<int64_t> last_active_ms;
+    std::atomic<timing_wheel::timer_id> idle_timer = 0;
+    std::atomic<bool> closing = false;
+
+    void arm_idle_timer(std::chrono::milliseconds delay);
+    void on_idle_timer();
+    void stop_idle_timer();
+    // 入队之后的收尾: 超过硬上限断开慢客户端, 队列关了返回false, 否则写一次
+    bool after_push(outbound_queue::PushResult res);
+
 public:
+    static constexpr std::chrono::milliseconds HEARTBEAT_INTERVAL{30 * 1000}; // 空闲这么久发心跳
+    static constexpr std::chrono::milliseconds IDLE_TIMEOUT{90 * 1000};       // 空闲这么久断开
+
     event* read_event = nullptr; // 读事件
     event* write_event = nullptr; // 写事件
     reactor* reactor_ptr = nullptr;
     AcceptedSocket* socket = nullptr; // 套接字
-    safe_queue<std::pair<std::string, DataType>> write_queue;
+    outbound_queue write_queue; // 发送队列, 可写时由flush()写出
     Dispatcher* dispatcher = nullptr;
     std::string user_ID;
     std::string temp_user_ID;
     DataType to_send_type = DataType::None;
     std::atomic<ReceiveStatus> receive_status = ReceiveStatus::Free; // 接收状态
     std::atomic<SendStatus> send_status = SendStatus::Free; // 发送状态
+    std::atomic<bool> read_paused = false; // 发送队列超过高水位时暂停读, 回到低水位再恢复
+    // 单连接复用模式: 三个通道共用这一条连接, 收发的帧都带通道头
+    std::atomic<bool> mux = false;
+    mux::reassembler mux_in; // 只在dispatch_recv里用, 同一连接同时只有一个线程在读
+    // 对端协商过v2帧格式; 没协商的连接发出前要把v2帧转回v1
+    std::atomic<bool> wire_v2 = false;
+    // 对端能解zstd压缩帧; 压缩/解压上下文跟着连接走, 反复使用
+    std::atomic<bool> wire_zstd = false;
+    wire::codec codec;
 
     TcpServerConnection(reactor* reactor_ptr, Dispatcher* disp);
     ~TcpServerConnection();
 
     void set_send_type(DataType type);
+    // 入队并尝试立即写出, 不阻塞
+    // 队列爆了说明对端收得太慢, 直接断开, 返回false
+    // 复用模式下按channel分片, 放进对应通道轮流发送
+    bool send_frame(std::string frame, int channel = 1);
+    // 文件帧: head在内存里, 数据从file的[offset, offset+len)直接sendfile出去
+    // 复用模式下按分片拆成多段, 每段仍是文件区间, 同样不拷贝
+    bool send_file_frame(std::string head, std::shared_ptr<shared_file> file,
+                         off_t offset, size_t len, int channel = 2);
+    // 共用帧: frame由多个连接共享, 队列里只放引用; 复用模式下每片只多一个字节的通道头
+    bool send_shared_frame(std::shared_ptr<const std::string> frame, int channel = 1);
+    // 数据类型 -> 复用通道(与三个逻辑服务器的下标一致); 聊天消息必须带DataType::Message, None走命令通道
+    static int channel_of(DataType type) {
+        switch (type) {
+            case DataType::Message:
+                return 0;
+            case DataType::FileChunk:
+            case DataType::SyncItem:
+            case DataType::OfflineMessages:
+                return 2;
+            default:
+                return 1;
+        }
+    }
+    // 尽量写出发送队列, 写不动就挂上写事件等EPOLLOUT
+    void flush();
+    // 生产者(比如文件下发)在高水位时等队列降到低水位
+    bool wait_writable(std::chrono::milliseconds timeout);
+    // 半关闭套接字, 让读事件走正常的断开流程
+    void shutdown();
+    // 收到数据时调用, O(1)
+    void touch();
+    // 开始心跳/空闲检测(定时器在所属reactor上)
+    void start_idle_timer();
+    // 销毁连接: 投递到所属reactor线程delete, 排在之前投递的布防任务之后
+    void release();
 };
@@ -19,7 +19,8 @@ namespace mysql_config {
 
 class TopServer {
 public:
-    thread_pool* pool = nullptr;
+    thread_pool* pool = nullptr;          // 事件处理, 只跑不阻塞的活
+    thread_pool* blocking_pool = nullptr; // 数据库、发邮件这类阻塞调用, 单独定大小和排队上限
     TcpServer* message_server = nullptr;
     TcpServer* command_server = nullptr;
     TcpServer* data_server = nullptr;
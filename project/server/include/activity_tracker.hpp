@@ -0,0 +1,73 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <shared_mutex>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include <chrono>
+
+class RedisController;
+class MySQLController;
+
+/*
+    在线用户的最后活跃时间, 攒在内存里定期批量落库
+    - 每收发一帧只在内存里记一下时间(读锁查表 + relaxed store), 不碰Redis和MySQL
+    - 后台线程每FLUSH_INTERVAL把变过的用户一次写进Redis(脚本只改仍在线的), 再用一条UPDATE写进MySQL
+    - 只记track()过的用户, 下线时forget(); 下线之后才到的touch()直接忽略,
+      免得刷写线程又把用户写回在线
+    - MySQL的last_active同时是离线消息的查询起点, 上线时要先拿旧值查离线消息,
+      所以要等enable_persist()之后才往MySQL写; 临时用户(_开头)不写MySQL
+*/
+class ActivityTracker {
+public:
+    ActivityTracker(RedisController* redis_con, MySQLController* mysql_con);
+    ~ActivityTracker();
+    ActivityTracker(const ActivityTracker&) = delete;
+    ActivityTracker& operator=(const ActivityTracker&) = delete;
+
+    void track(const std::string& user_ID);
+    void touch(const std::string& user_ID);
+    void enable_persist(const std::string& user_ID);
+    // 不做IO; 还没写进MySQL的时间留给下一次刷写
+    void forget(const std::string& user_ID);
+
+    // 停掉刷写线程并把剩下的写完, 要在关数据库连接之前调
+    void stop();
+
+private:
+    static constexpr size_t SHARD_NUM = 16;
+    static constexpr auto FLUSH_INTERVAL = std::chrono::seconds(5);
+
+    struct entry {
+        std::atomic<std::int64_t> last_active{0}; // 微秒
+        std::atomic<bool> persist{false};
+        std::int64_t flushed = 0; // 上次写出去的值, 只有刷写线程(持分片读锁)改, forget()持分片写锁读
+    };
+
+    struct shard {
+        std::shared_mutex m_Mutex;
+        std::unordered_map<std::string, std::unique_ptr<entry>> users;
+    };
+
+    RedisController* redis_con;
+    MySQLController* mysql_con;
+    shard shards[SHARD_NUM];
+
+    // 只护retired, 锁内不做IO; forget()不会等Redis
+    std::mutex retired_mutex;
+    std::vector<std::pair<std::string, std::int64_t>> retired; // 已下线、还没写MySQL的
+
+    std::mutex wait_mutex;
+    std::condition_variable wait_cv;
+    bool running = true;
+    std::thread flush_thread;
+
+    shard& shard_of(const std::string& user_ID);
+    void flush();
+};
@@ -4,11 +4,13 @@
 #include "../../io/include/reactor.hpp"
 #include <string>
 #include <array>
+#include <vector>
 #include <unordered_map>
 #include <thread>
 #include <mutex>
 #include <atomic>
 #include "TcpServerConnection.hpp"
+#include "activity_tracker.hpp"
 
 class Dispatcher;
 
@@ -18,26 +20,17 @@ private:
     std::unordered_map<std::string, std::array<TcpServerConnection*, 3>> user_connections;
     Dispatcher* disp;
 
-    // 心跳监控相关
-    std::thread heartbeat_thread;
     std::mutex user_mutex;
-    bool heartbeat_running = false;
 
-    void start_heartbeat_monitor();
-    void check_user_timeouts();
-    void send_heartbeat_to_user(const std::string& user_ID);
+    // 收发帧时的活跃时间, 攒起来定期落库
+    ActivityTracker activity;
 
-public:
-    ConnectionManager(Dispatcher* disp) : disp(disp) {
-        start_heartbeat_monitor();
-    }
+    // 放入新连接; 旧连接不再被任何位置引用时才释放(复用连接会同时占三个位置)
+    void replace_slot(std::array<TcpServerConnection*, 3>& conns, int server_index, TcpServerConnection* conn);
 
-    ~ConnectionManager() {
-        heartbeat_running = false;
-        if (heartbeat_thread.joinable()) {
-            heartbeat_thread.join();
-        }
-    }
+public:
+    // 心跳和空闲断开由各命令连接在reactor的时间轮上自己管
+    ConnectionManager(Dispatcher* disp);
 
     void add_temp_conn(TcpServerConnection* conn, int server_index);
     void add_conn(TcpServerConnection* conn, int server_index);
@@ -45,5 +38,13 @@ public:
     void destroy_connection(std::string user_ID);
     bool user_exists(std::string user_ID);
     TcpServerConnection* get_connection(const std::string& user_ID, int server_index = 0);
+    // 批量查, 整批只加一次锁; 跳过except和不在线的用户
+    std::vector<TcpServerConnection*> get_connections(
+        const std::vector<std::string>& user_IDs, int server_index = 0, const std::string& except = "");
+    // 只记内存, 不直接写库
     void update_user_activity(const std::string& user_ID);
+    // 上线拿完离线消息后调用, 之后活跃时间才写进MySQL的last_active
+    void persist_user_activity(const std::string& user_ID);
+    // 关服时把还没落库的活跃时间写完
+    void stop_activity_tracker();
 };
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <memory>
+#include <string_view>
 #include <unordered_map>
 #include <functional>
 #include "../../global/abstract/datatypes.hpp"
@@ -17,6 +18,7 @@ class SyncHandler;
 class OfflineMessageHandler;
 class ConnectionManager;
 class SFileManager;
+class thread_pool;
 
 class Dispatcher {
 public:
@@ -33,15 +35,32 @@ public:
     std::thread flush_message_thread;
 
     void add_server(TcpServer* server, int idx);
+    void set_blocking_pool(thread_pool* pool);
+    thread_pool* get_blocking_pool() const { return blocking_pool; }
     void dispatch_recv(TcpServerConnection* conn);
     void dispatch_send(TcpServerConnection* conn);
 
 private:
     bool running = false;
+    thread_pool* blocking_pool = nullptr; // 查库、发邮件的命令转到这里执行
 
     CommandHandler* command_handler = nullptr;
     MessageHandler* message_handler = nullptr;
     FileHandler* file_handler = nullptr;
     SyncHandler* sync_handler = nullptr;
     OfflineMessageHandler* offline_message_handler = nullptr;
+
+    // 断开或读出错: 按用户走下线流程并回收连接, 之后不能再用conn
+    void drop_connection(TcpServerConnection* conn);
+
+    // 接收跳转表, 按DataType下标取, 服务器不收的类型为空
+    // body是具体消息的字节, frame是整帧(转发/缓存用)
+    // 返回false表示这一帧转交给了阻塞池, 连接暂停读取, 由那边做完后接着读
+    using recv_fn = bool (Dispatcher::*)(TcpServerConnection*, std::string_view body, std::string_view frame);
+    static const recv_fn recv_table[];
+    // 一个完整的包: 拆帧后查表分发, 返回值同recv_fn
+    bool handle_frame(TcpServerConnection* conn, std::string_view frame);
+    bool recv_message(TcpServerConnection* conn, std::string_view body, std::string_view frame);
+    bool recv_command(TcpServerConnection* conn, std::string_view body, std::string_view frame);
+    bool recv_file_chunk(TcpServerConnection* conn, std::string_view body, std::string_view frame);
 };
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include <shared_mutex>
+#include <cstdint>
+
+/*
+    进程内的群成员缓存, 读多写少
+    - 按群号哈希分片, 每片一把读写锁, 发群消息只加读锁
+    - 每个群一份排好序的成员数组, 只读, 用shared_ptr交出去, 读的人不用拷贝也不用持锁
+    - 第一次用到时通过loader从Redis装载; 成员变动时invalidate(), 下次用到重新装载
+    - 装载期间被invalidate()过的结果不放进缓存, 免得把旧名单存回去
+    - 装载出空名单不缓存: 群号不存在和群被解散都是空的, 存下来就永远不会淘汰
+*/
+class GroupMemberCache {
+public:
+    using members_ptr = std::shared_ptr<const std::vector<std::string>>;
+    // 装载失败应抛异常; 群不存在时返回空名单
+    using loader = std::function<std::vector<std::string>(const std::string& group_ID)>;
+
+    explicit GroupMemberCache(loader load) : load(std::move(load)) {}
+    GroupMemberCache(const GroupMemberCache&) = delete;
+    GroupMemberCache& operator=(const GroupMemberCache&) = delete;
+
+    members_ptr members(const std::string& group_ID);
+    bool is_member(const std::string& group_ID, const std::string& user_ID);
+    void invalidate(const std::string& group_ID);
+    // 失效通知可能漏了(比如订阅连接断过), 整个清掉
+    void clear();
+
+private:
+    static constexpr size_t SHARD_NUM = 16;
+
+    struct shard {
+        std::shared_mutex m_Mutex;
+        std::unordered_map<std::string, members_ptr> groups;
+        uint64_t generation = 0; // 每次失效加一, 装载前后对比
+    };
+
+    shard shards[SHARD_NUM];
+    loader load;
+
+    shard& shard_of(const std::string& group_ID);
+};
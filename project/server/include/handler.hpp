@@ -1,8 +1,10 @@
 #pragma once
 
 #include <string>
+#include <vector>
 #include <nlohmann/json.hpp>
 #include "../../global/abstract/datatypes.hpp"
+#include "../../global/include/co_task.hpp"
 
 class Dispatcher;
 class TcpServer;
@@ -22,10 +24,25 @@ void try_send(ConnectionManager* conn_manager,
     DataType type = DataType::None
 );
 
+// 同一帧发给一批连接: 每种线路形态只编一次, 各发送队列共用同一块缓冲区;
+// 人多时切片, 由当前线程池的worker一起发, 发完才返回
+// type决定复用模式下走哪个通道, 没有默认值: 聊天要传Message, 命令通知传None
+// packed: 调用方手上已有的压缩形态(可空), 协商了zstd的连接直接用
+void fanout_send(ConnectionManager* conn_manager,
+    std::vector<TcpServerConnection*> conns,
+    std::string proto,
+    DataType type,
+    std::string packed = {}
+);
+
 class Handler {
 public:
     Dispatcher* disp = nullptr;
     Handler(Dispatcher* dispatcher);
+
+protected:
+    // 协程里co_await run_blocking(blocking_pool(), ...)查库
+    thread_pool* blocking_pool() const;
 };
 
 /* -------------- Message -------------- */
@@ -34,7 +51,7 @@ class MessageHandler : public Handler {
 public:
     MessageHandler(Dispatcher* dispatcher);
 
-    void handle_recv(const ChatMessage& message, const std::string& ostr);
+    void handle_recv(const wire::chat_view& message, std::string_view raw);
     void handle_send(TcpServerConnection* conn);
 };
 
@@ -49,20 +66,25 @@ public:
         TcpServerConnection* conn,
         const CommandRequest& command,
         const std::string& ostr);
+    // 登录、上线初始化这类要连查多次库的命令写成协程, 查库时挂起, 不占worker
+    co_task<> handle_recv_async(
+        TcpServerConnection* conn,
+        CommandRequest command,
+        std::string ostr);
     void handle_send(TcpServerConnection* conn);
 
 private:
-    void handle_sign_in(
+    co_task<> handle_sign_in(
         TcpServerConnection* conn,
-        const std::string& subj,
-        const std::string& password);
+        std::string subj,
+        std::string password);
     void handle_sign_out(const std::string& user_ID);
     void handle_uncommon_disconnect(const std::string& user_ID);
     void handle_register(
         TcpServerConnection* conn,
         const std::string& email,
-        std::string& user_ID,
-        std::string& user_password);
+        const std::string& user_ID,
+        const std::string& user_password);
     void handle_unregister(const std::string& user_ID, CommandRequest& cmd);
     void handle_send_veri_code(
         TcpServerConnection* conn,
@@ -153,14 +175,20 @@ private:
         TcpServerConnection* conn,
         const std::string& temp_user_ID,
         int server_index);
-    void handle_online_init(
-        const std::string& user_ID,
+    co_task<> handle_online_init(
+        std::string user_ID,
         TcpServerConnection* conn);
+    void handle_mux_connection(TcpServerConnection* conn);
+    void handle_wire_version(
+        TcpServerConnection* conn,
+        const std::string& version,
+        const std::string& server_index,
+        const std::string& codecs);
 
     // 非直接指令驱动的业务逻辑
     void handle_post_relation_net(const std::string& user_ID, const json& relation_data);
     void handle_post_friends_status(const std::string& user_ID, const json& friends);
-    void handle_post_offline_messages(const std::string& user_ID, const json& relation_data);
+    co_task<> handle_post_offline_messages(std::string user_ID, const json& relation_data);
 
     // 封装起来的函数
     void get_friends(const std::string& user_ID, json& friends);
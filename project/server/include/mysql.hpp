@@ -43,7 +43,9 @@ public:
         const std::string& email,
         const std::string& password_hash);
     bool check_user_pswd(const std::string& email, const std::string& password_hash);
-    void update_user_last_active(const std::string& email);
+    void update_user_last_active(const std::string& user_ID);
+    // 批量写最后活跃时间(微秒), 每ACTIVE_BATCH个用户一条UPDATE
+    bool update_users_last_active(const std::vector<std::pair<std::string, std::int64_t>>& users);
     std::string get_user_id_from_email(const std::string& email);
     std::string get_user_email_from_id(const std::string& user_ID);
     bool update_user_status(const std::string& user_ID, bool online);
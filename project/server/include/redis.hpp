@@ -3,7 +3,11 @@
 #include <sw/redis++/redis++.h>
 #include <string>
 #include <utility>
+#include <thread>
+#include <atomic>
+#include <mutex>
 #include <nlohmann/json.hpp>
+#include "group_cache.hpp"
 using json = nlohmann::json;
 
 /*
@@ -27,6 +31,9 @@ chat:user:<user_id>:groups -> Set {group_id1, group_id2, ...} // 群组ID列表
 
 群组成员缓存：
 chat:group:<group_id>:members -> Set {user_id1, user_id2, user_id3, ...}
+进程内另有一份(GroupMemberCache), 成员集合变动后往下面的频道发"<实例号> <group_id>",
+其他服务器进程收到后把本地那份作废：
+chat:group:invalidate -> Pub/Sub频道
 
 群组管理员缓存：
 chat:group:<group_id>:admins -> Set {admin_id1, admin_id2, ...}
@@ -57,6 +64,7 @@ public:
     using Redis = sw::redis::Redis;
 
     RedisController();
+    ~RedisController();
 
 /* ==================== 消息批量缓存 ==================== */
 
@@ -70,6 +78,24 @@ public:
     // 返回的 vector 中每个元素是 protobuf ChatMessage 的二进制
     std::vector<std::string> pop_chat_messages_batch(size_t count);
 
+    // 私聊的检查结果
+    enum class PrivateVerdict {
+        NotFriend = 0,
+        Blocked = 1,   // 被对方屏蔽
+        Offline = 2,   // 已缓存, 对方不在线
+        Online = 3,    // 已缓存, 对方在线
+        Error = -1
+    };
+
+    // 好友、屏蔽、在线检查和消息缓存合成一个Lua脚本(EVALSHA), 一次往返;
+    // 只有NotFriend/Blocked时不缓存
+    PrivateVerdict check_and_cache_private_message(
+        const std::string& sender,
+        const std::string& receiver,
+        const std::string& serialized_msg,
+        const std::string& conv,
+        int64_t timestamp);
+
     // 暂时获取限定个数的历史消息（未落盘的）
     std::vector<std::string> get_offline_messages(
         const std::string& user_ID,
@@ -83,6 +109,9 @@ public:
 
     void set_user_status(const std::string& user_ID, bool online);
 
+    // 批量刷在线用户的最后活跃时间(微秒), 一次脚本调用; 已经离线的用户不会被改回在线
+    void set_users_active(const std::vector<std::pair<std::string, std::int64_t>>& users);
+
     void del_user_status(const std::string& user_ID);
 
 /* ==================== 验证码 ==================== */
@@ -140,8 +169,11 @@ public:
 
     bool remove_group(const std::string& group_ID);
 
+    // 成员查询走进程内缓存
     bool is_group_member(const std::string& group_ID, const std::string& user_ID);
     std::vector<std::string> get_group_members(const std::string& group_ID);
+    // 同上, 但不拷贝, 直接拿缓存里那份排好序的只读名单
+    GroupMemberCache::members_ptr get_group_members_shared(const std::string& group_ID);
 
     bool is_group_admin(const std::string& group_ID, const std::string& user_ID);
     std::vector<std::string> get_group_admins(const std::string& group_ID);
@@ -164,4 +196,17 @@ public:
 
 private:
     Redis redis_conn; // 实际连接对象
+
+    std::mutex script_mutex;
+    std::string private_msg_sha; // 私聊检查脚本的SHA1, 第一次用时加载, 服务器重启丢了再加载
+
+    GroupMemberCache group_cache;
+    std::string instance_ID; // 区分失效通知是不是自己发的
+    std::atomic<bool> running = true;
+    std::thread invalidation_thread;
+
+    // 本地作废并通知其他进程
+    void invalidate_group(const std::string& group_ID);
+    // 订阅失效频道, 断线重连后整个缓存清掉(期间的通知可能丢了)
+    void listen_invalidations();
 };
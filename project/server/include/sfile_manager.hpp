@@ -30,6 +30,8 @@ public:
     std::unordered_map<std::string, FileUploadTask> upload_tasks;
     std::unordered_map<std::string, FileDownloadTask> download_tasks;
     std::string storage;
+    // 直通下载: 分片数据不进protobuf, 由sendfile从存储文件直接写进socket
+    bool raw_download = true;
 
     SFileManager(Dispatcher* dispatcher);
     ~SFileManager();
@@ -40,9 +42,10 @@ public:
     void add_upload_task(const std::string& user_id, ServerFilePtr server_file);
 
 private:
-    void send_file_chunk(const std::string& user_id, const std::string& file_id,
+    bool send_file_chunk(const std::string& user_id, const std::string& file_id,
                         const std::vector<char>& chunk_data, size_t chunk_index,
                         size_t total_chunks, bool is_last_chunk);
+    bool send_raw_chunks(const FileDownloadTask& task, const ServerFilePtr& server_file);
     void process_single_download_task(const FileDownloadTask& task);
     void process_single_upload_task(const FileUploadTask& task);
 };
\ No newline at end of file
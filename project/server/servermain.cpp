@@ -3,12 +3,15 @@
 #include "../global/include/logging.hpp"
 #include <string>
 #include <istream>
+#include <csignal>
 
 int main(int argc, char* argv[]) {
+    // sendfile没有MSG_NOSIGNAL, 对端断开时不能让SIGPIPE把进程带走
+    std::signal(SIGPIPE, SIG_IGN);
     if (argc > 1) {
         mysql_config::config(argv[1]);
     }
-    if (argc == 5) {
+    if (argc >= 5) {
         uint16_t port1 = std::stoi(argv[2]);
         uint16_t port2 = std::stoi(argv[3]);
         uint16_t port3 = std::stoi(argv[4]);
@@ -16,6 +19,10 @@ int main(int argc, char* argv[]) {
         set_addr_s::server_addr[1] = {"0.0.0.0", port2};
         set_addr_s::server_addr[2] = {"0.0.0.0", port3};
     }
+    if (argc == 6) {
+        // 每个逻辑服务器的reactor数量, 大于1时启用SO_REUSEPORT分流
+        set_addr_s::loop_num = std::max(1, std::stoi(argv[5]));
+    }
     spdlog::set_level(spdlog::level::debug);
     std::srand(std::time(nullptr));
     TopServer server;
@@ -0,0 +1,71 @@
+// 复用通道回归测试: 聊天帧按类型选通道, 切片重组后必须落在消息通道(0)上,
+// 否则--mux的客户端会把它当命令解析然后丢掉
+//
+// 用法: mux_channel_test, 全部通过返回0
+
+#include "../global/abstract/datatypes.hpp"
+#include "../io/include/mux_frame.hpp"
+#include "../server/include/TcpServerConnection.hpp"
+#include <cstdio>
+#include <string>
+
+namespace {
+    int failures = 0;
+
+    void check(bool ok, const char* what) {
+        if (!ok) {
+            printf("FAILED: %s\n", what);
+            ++failures;
+        }
+    }
+
+    // 按帧自己的类型选通道, 切片后逐片喂给重组器, 返回凑齐时的通道, 没凑齐返回-1
+    int route(const std::string& frame, std::string& out) {
+        wire::scratch sc;
+        std::string_view body;
+        int channel = TcpServerConnection::channel_of(wire::decode(frame, body, sc));
+        mux::reassembler in;
+        int got = -1;
+        for (auto& piece : mux::split(channel, frame)) {
+            std::string_view packet;
+            if (in.feed(piece, got, packet)) {
+                out.assign(packet);
+                return got;
+            }
+            if (got < 0) {
+                return -1;
+            }
+        }
+        return -1;
+    }
+
+    void test_chat(bool is_group, size_t text_size) {
+        std::string frame = create_message_string("sender_0001", is_group ? "group_0042" : "receiver_0002",
+                                                  is_group, 1700000000000000, std::string(text_size, 'x'));
+        std::string packet;
+        check(route(frame, packet) == 0, "chat frame should arrive on channel 0");
+        check(packet == frame, "chat frame should be reassembled intact");
+    }
+
+    void test_command() {
+        std::string frame = create_command_string(Action::HEARTBEAT, "sender_0001", {});
+        std::string packet;
+        check(route(frame, packet) == 1, "command frame should arrive on channel 1");
+        check(packet == frame, "command frame should be reassembled intact");
+    }
+}
+
+int main() {
+    for (int version = 1; version <= 2; ++version) {
+        wire::set_version(version);
+        test_chat(false, 300);
+        test_chat(true, 300);
+        test_chat(false, 3 * mux::FRAGMENT_SIZE + 17); // 多片
+        test_command();
+    }
+    check(TcpServerConnection::channel_of(DataType::None) == 1, "untyped frames go to the command channel");
+    if (failures == 0) {
+        printf("mux_channel_test passed\n");
+    }
+    return failures == 0 ? 0 : 1;
+}